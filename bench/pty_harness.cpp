@@ -0,0 +1,469 @@
+// End-to-end latency and throughput of the interactive shell, measured the
+// way a user sees it: `shell` runs under a pseudo-terminal, keystrokes are
+// written to the master side and each echo or redraw is timestamped when it
+// comes back. Every scenario also checks what came back, so a run doubles
+// as a regression suite for the line editor (exit status 1 on any failure).
+// The check-* scenarios run scripts on a pipe and compare their output; ctest
+// runs just those.
+//
+//   shell_pty [--shell PATH] [--runs N] [--filter PREFIX] [--json FILE]
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/wait.h>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+#ifndef SHELL_PATH
+#define SHELL_PATH "./shell"
+#endif
+
+namespace {
+    uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const int TIMEOUT_MS = 3000;
+
+    // Everything the child needs: a PATH with a few known names in front,
+    // and no history file or completion cache outside the scratch directory.
+    struct Setup {
+        std::string shell;
+        fs::path scratch;
+        std::vector<std::string> env;
+
+        void prepare() {
+            char tmpl[] = "/tmp/shell_pty.XXXXXX";
+            scratch = mkdtemp(tmpl);
+            fs::create_directory(scratch / "bin");
+            for(const char *name: {"zz-alpha", "zz-beta", "zz-gamma"}) {
+                fs::path p = scratch / "bin" / name;
+                std::ofstream(p) << "#!/bin/sh\n";
+                fs::permissions(p, fs::perms::owner_all);
+            }
+            env = {"PATH=" + (scratch / "bin").string() + ":/usr/bin:/bin", "HOME=" + scratch.string(),
+                   "SHELL_INDEX_CACHE=" + (scratch / "completion.idx").string(), "TERM=xterm", "HISTSIZE=500"};
+        }
+        ~Setup() {
+            std::error_code ec;
+            if(!scratch.empty()) fs::remove_all(scratch, ec);
+        }
+    };
+
+    // One shell on a pty. `out` keeps everything it wrote.
+    class Pty {
+    public:
+        std::string out;
+        uint64_t started = 0;
+
+        explicit Pty(const Setup &setup) {
+            struct winsize ws = {24, 80, 0, 0};
+            started = now_ns();
+            pid = forkpty(&fd, nullptr, nullptr, &ws);
+            if(pid == 0) {
+                std::vector<char*> envp;
+                for(auto &e: setup.env) envp.push_back(const_cast<char*>(e.c_str()));
+                envp.push_back(nullptr);
+                char *argv[] = {const_cast<char*>(setup.shell.c_str()), nullptr};
+                execve(argv[0], argv, envp.data());
+                _exit(127);
+            }
+        }
+        ~Pty() {
+            if(pid > 0) {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+            }
+            if(fd != -1) close(fd);
+        }
+        Pty(const Pty&) = delete;
+        Pty& operator=(const Pty&) = delete;
+
+        bool ok() const { return pid > 0; }
+        size_t mark() const { return out.size(); }
+
+        uint64_t send(std::string_view keys) {
+            uint64_t t = now_ns();
+            (void)!write(fd, keys.data(), keys.size());
+            return t;
+        }
+
+        // Read until `text` shows up past `from` (any output at all if text is
+        // empty). Returns when the read that completed it arrived, 0 on timeout.
+        uint64_t wait_for(std::string_view text, size_t from, int timeout_ms = TIMEOUT_MS) {
+            uint64_t deadline = now_ns() + uint64_t(timeout_ms) * 1000000;
+            while(true) {
+                if(text.empty() ? out.size() > from : out.find(text, from) != std::string::npos) return last_read;
+                uint64_t now = now_ns();
+                if(now >= deadline) return 0;
+                struct pollfd p = {fd, POLLIN, 0};
+                if(poll(&p, 1, int((deadline - now) / 1000000) + 1) <= 0) continue;
+                char buf[65536];
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if(n <= 0) return 0;
+                last_read = now_ns();
+                out.append(buf, n);
+            }
+        }
+
+        // Send keys and wait for `text`: microseconds until it appeared, or -1.
+        double roundtrip(std::string_view keys, std::string_view text) {
+            size_t from = mark();
+            uint64_t t0 = send(keys);
+            uint64_t t1 = wait_for(text, from);
+            return t1 ? (t1 - t0) / 1e3 : -1;
+        }
+
+        bool prompt(size_t from) { return wait_for("$ ", from) != 0; }
+
+    private:
+        int fd = -1;
+        pid_t pid = -1;
+        uint64_t last_read = 0;
+    };
+
+    struct Scenario {
+        std::string name;
+        std::vector<double> samples;   // latency in us, or per-run figures
+        std::string unit = "us";
+        std::string failure;           // empty = passed
+
+        void check(bool cond, const std::string &what) {
+            if(!cond && failure.empty()) failure = what;
+        }
+        // Record a roundtrip result, failing the scenario on a timeout.
+        void sample(double us, const std::string &what) {
+            if(us < 0) check(false, what + ": timed out");
+            else samples.push_back(us);
+        }
+    };
+
+    // The completion index is built on a thread after the first prompt; wait
+    // until Tab knows about the PATH names.
+    bool wait_index(Pty &pty) {
+        for(int i = 0; i < 50; ++i) {
+            size_t from = pty.mark();
+            pty.send("zz-al\t");
+            bool done = pty.wait_for("pha", from, 100) != 0;
+            pty.send("\x15");   // Ctrl-U
+            pty.wait_for("", pty.mark(), 100);
+            if(done) return true;
+        }
+        return false;
+    }
+
+    void startup(const Setup &setup, Scenario &s, size_t runs) {
+        for(size_t i = 0; i < runs; ++i) {
+            Pty pty(setup);
+            s.check(pty.ok(), "forkpty failed");
+            uint64_t t = pty.wait_for("$ ", 0);
+            s.sample(t ? (t - pty.started) / 1e3 : -1, "first prompt");
+        }
+    }
+
+    void keystroke_echo(const Setup &setup, Scenario &s, size_t runs) {
+        Pty pty(setup);
+        s.check(pty.prompt(0), "no prompt");
+        std::string text = "echo the quick brown fox";
+        for(size_t i = 0; i < runs && s.failure.empty(); ++i) {
+            for(char c: text) s.sample(pty.roundtrip(std::string(1, c), std::string(1, c)), "echo of '" + std::string(1, c) + "'");
+            size_t from = pty.mark();
+            pty.send("\r");
+            s.check(pty.wait_for("the quick brown fox\r\n", from) != 0, "command output missing");
+            s.check(pty.prompt(from), "no prompt after command");
+        }
+    }
+
+    void tab(const Setup &setup, Scenario &s, size_t runs) {
+        Pty pty(setup);
+        s.check(pty.prompt(0) && wait_index(pty), "completion index never became ready");
+        for(size_t i = 0; i < runs && s.failure.empty(); ++i) {
+            pty.send("ech");
+            pty.wait_for("ech", pty.mark());
+            s.sample(pty.roundtrip("\t", "o "), "Tab on 'ech'");
+            pty.send("\x15");
+            pty.wait_for("", pty.mark());
+            pty.send("zz-g");
+            pty.wait_for("g", pty.mark());
+            s.sample(pty.roundtrip("\t", "amma "), "Tab on a PATH name");
+            pty.send("\x15");
+            pty.wait_for("", pty.mark());
+        }
+    }
+
+    void double_tab(const Setup &setup, Scenario &s, size_t runs) {
+        Pty pty(setup);
+        s.check(pty.prompt(0) && wait_index(pty), "completion index never became ready");
+        for(size_t i = 0; i < runs && s.failure.empty(); ++i) {
+            pty.send("zz-");
+            pty.wait_for("zz-", pty.mark());
+            // Three matches with nothing more in common: the first Tab only rings.
+            s.sample(pty.roundtrip("\t", "\a"), "first Tab");
+            size_t from = pty.mark();
+            s.sample(pty.roundtrip("\t", "zz-gamma"), "listing on second Tab");
+            s.check(pty.out.find("zz-alpha", from) != std::string::npos && pty.out.find("zz-beta", from) != std::string::npos,
+                    "listing is missing names");
+            s.check(pty.prompt(from), "prompt not redrawn under the listing");
+            pty.send("\x15");
+            pty.wait_for("", pty.mark());
+        }
+    }
+
+    void arrows(const Setup &setup, Scenario &s, size_t runs) {
+        Pty pty(setup);
+        s.check(pty.prompt(0), "no prompt");
+        for(size_t i = 0; i < runs && s.failure.empty(); ++i) {
+            size_t from = pty.mark();
+            pty.send("echo first\r");
+            s.check(pty.wait_for("first\r\n", from) && pty.prompt(from + 1), "command output missing");
+            s.sample(pty.roundtrip("\033[A", "echo first"), "Up arrow recall");
+            for(int k = 0; k < 5; ++k) s.sample(pty.roundtrip("\033[D", ""), "Left arrow redraw");
+            s.sample(pty.roundtrip("X", ""), "insert mid-line");
+            from = pty.mark();
+            pty.send("\r");
+            s.check(pty.wait_for("Xfirst\r\n", from) != 0, "edited line ran wrong");
+            s.check(pty.prompt(from), "no prompt after command");
+        }
+    }
+
+    void search(const Setup &setup, Scenario &s, size_t runs) {
+        Pty pty(setup);
+        s.check(pty.prompt(0), "no prompt");
+        size_t from = pty.mark();
+        pty.send("echo needle-in-history\r");
+        s.check(pty.wait_for("needle-in-history\r\n", from) && pty.prompt(from + 1), "command output missing");
+        for(size_t i = 0; i < runs && s.failure.empty(); ++i) {
+            pty.send("\x12");   // Ctrl-R
+            pty.wait_for("", pty.mark());
+            s.sample(pty.roundtrip("needle", "echo needle-in-history"), "Ctrl-R match");
+            pty.send("\x07");   // Ctrl-G
+            pty.wait_for("", pty.mark());
+        }
+    }
+
+    // Run the shell on a script from a pipe: no pty here, since a terminal on
+    // stdin would make the shell interactive. Its stdout and stderr go to
+    // `out_fd`, in the scratch directory. Returns the wait status, or -1.
+    int run_script(const Setup &setup, const std::string &text, int out_fd, const std::vector<std::string> &args = {}) {
+        int in[2];
+        if(pipe(in) < 0) return -1;
+        pid_t pid = fork();
+        if(pid == 0) {
+            dup2(in[0], 0);
+            dup2(out_fd, 1);
+            dup2(out_fd, 2);
+            // Whatever ran us (ctest, for one) may have left fds open; the
+            // scripts expect to start with just 0-2.
+            close_range(3, ~0U, 0);
+            if(chdir(setup.scratch.c_str()) != 0) _exit(127);
+            std::vector<char*> envp;
+            for(auto &e: setup.env) envp.push_back(const_cast<char*>(e.c_str()));
+            envp.push_back(nullptr);
+            std::vector<char*> argv = {const_cast<char*>(setup.shell.c_str())};
+            for(auto &a: args) argv.push_back(const_cast<char*>(a.c_str()));
+            argv.push_back(nullptr);
+            execve(argv[0], argv.data(), envp.data());
+            _exit(127);
+        }
+        close(in[0]);
+        std::thread([fd = in[1], &text] {
+            (void)!write(fd, text.data(), text.size());
+            close(fd);
+        }).join();
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return status;
+    }
+
+    // Commands per second from a script on a pipe.
+    void script(const Setup &setup, Scenario &s, size_t runs, const std::string &line, size_t count) {
+        std::string text;
+        for(size_t i = 0; i < count; ++i) text += line + "\n";
+        s.unit = "cmd/s";
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        for(size_t r = 0; r < runs; ++r) {
+            uint64_t t0 = now_ns();
+            int status = run_script(setup, text, null);
+            double secs = (now_ns() - t0) / 1e9;
+            s.check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "script exited with status " + std::to_string(status));
+            s.samples.push_back(count / secs);
+        }
+        close(null);
+    }
+
+    // Run `text` as a script and compare what it printed (stdout and stderr
+    // together) and its exit status. One sample: how long it took, in us.
+    void expect(const Setup &setup, Scenario &s, const std::string &text, const std::string &output,
+                int exit_code = 0, const std::vector<std::string> &args = {}) {
+        fs::path file = setup.scratch / "script.out";
+        int out = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(out < 0) return s.check(false, "cannot create " + file.string());
+        uint64_t t0 = now_ns();
+        int status = run_script(setup, text, out, args);
+        s.samples.push_back((now_ns() - t0) / 1e3);
+        close(out);
+        std::ifstream in(file);
+        std::string got((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        s.check(got == output, "`" + text + "` printed \"" + got + "\"");
+        s.check(WIFEXITED(status) && WEXITSTATUS(status) == exit_code,
+                "`" + text + "` exited with status " + std::to_string(WEXITSTATUS(status)));
+    }
+
+    // && and ||, ; and &, and the lines they make ill-formed.
+    void lists(const Setup &setup, Scenario &s) {
+        expect(setup, s, "false && echo RAN\necho $?\n", "1\n");
+        expect(setup, s, "false || echo RAN\ntrue || echo no\necho $?\n", "RAN\n0\n");
+        expect(setup, s, "true && echo a || echo b\nfalse && echo a || echo b\n", "a\nb\n");
+        expect(setup, s, "echo a&&echo b;echo c ; false\necho $?\n", "a\nb\nc\n1\n");
+        expect(setup, s, "echo '&&' \"||\" ';' b\n", "&& || ; b\n");
+        std::pair<const char*, const char*> bad[] = {
+            {"echo x | | cat", "|"}, {"true | ;", ";"}, {"echo a &;", ";"}, {"; echo a", ";"},
+            {"&& echo a", "&&"}, {"echo a || || echo b", "||"},
+        };
+        for(auto [line, token]: bad) {
+            expect(setup, s, std::string(line) + "\necho $?\n", "syntax error near unexpected token `" + std::string(token) + "'\n2\n");
+        }
+        expect(setup, s, "echo a |\necho a &&\n", "syntax error near unexpected token `newline'\n"
+                                                     "syntax error near unexpected token `newline'\n", 2);
+        expect(setup, s, "echo a &\nwait\necho b;\n", "a\nb\n");
+    }
+
+    // A script, -c or piped input exits with the last $?, or what `exit` says.
+    void exit_status(const Setup &setup, Scenario &s) {
+        expect(setup, s, "", "", 1, {"-c", "false"});
+        expect(setup, s, "", "", 3, {"-c", "exit 3; echo no"});
+        expect(setup, s, "true\nfalse\n", "", 1);
+        expect(setup, s, "nosuch-command\n", "nosuch-command: not found\n", 127);
+        expect(setup, s, "false || exit 7\necho no\n", "", 7);
+        expect(setup, s, "false\nexit\n", "", 1);
+        expect(setup, s, "exit x\n", "exit: x: numeric argument required\n", 2);
+    }
+
+    // N>&M needs M open: by an earlier redirection, or inherited by the shell.
+    void redirect_fds(const Setup &setup, Scenario &s) {
+        expect(setup, s, "echo x >&3\necho $?\n/bin/echo y >&3\necho $?\n",
+               "3: Bad file descriptor\n1\n3: Bad file descriptor\n1\n");
+        expect(setup, s, "echo a 3>f >&3\n/bin/echo b 3>>f >&3\ncat f\necho c 3>&- >&3\n",
+               "a\nb\n3: Bad file descriptor\n", 1);
+    }
+
+    // `type` reads the hash table but never adds to it or counts a hit.
+    void hash_table(const Setup &setup, Scenario &s) {
+        expect(setup, s, "type zz-alpha\nhash\nzz-alpha\ntype zz-alpha\nhash\n",
+               "zz-alpha is " + (setup.scratch / "bin" / "zz-alpha").string() + "\nhash: hash table empty\n"
+               "zz-alpha is " + (setup.scratch / "bin" / "zz-alpha").string() + "\nhits\tcommand\n   1\t" +
+               (setup.scratch / "bin" / "zz-alpha").string() + "\n");
+    }
+
+    // A word with any quoted part is one field, even when it comes out empty.
+    void quoting(const Setup &setup, Scenario &s) {
+        expect(setup, s, "test -n \"$UNSET\"; echo $?\n", "1\n");
+        expect(setup, s, "printf '[%s]\\n' \"$UNSET\" x $UNSET ''\n", "[]\n[x]\n[]\n");
+        expect(setup, s, "echo a \"\" b\necho \"$UNSET\"x\n", "a  b\nx\n");
+    }
+
+    // cat/head/tee/wc run in the shell only with the options they implement;
+    // anything else goes to the command on PATH.
+    void fd_fallback(const Setup &setup, Scenario &s) {
+        expect(setup, s, "echo a > f\ncat -n f\ncat -A f\n", "     1\ta\na$\n");
+        expect(setup, s, "echo a > f\nwc -m f\nwc -lc f\n", "2 f\n1 2 f\n");
+        expect(setup, s, "printf '1\\n2\\n3\\n' > f\nhead -q -n 1 f\nhead -n -1 f\nhead -2 f | cat\n", "1\n1\n2\n1\n2\n");
+        expect(setup, s, "echo x | tee -i g\ncat g\n", "x\nx\n");
+    }
+
+    double percentile(const std::vector<double> &sorted, double p) {
+        if(sorted.empty()) return 0;
+        size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Setup setup;
+    setup.shell = SHELL_PATH;
+    size_t runs = 20;
+    std::string filter, json;
+    for(int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "--shell" && has_value) setup.shell = argv[++i];
+        else if(arg == "--runs" && has_value) runs = std::max(1, atoi(argv[++i]));
+        else if(arg == "--filter" && has_value) filter = argv[++i];
+        else if(arg == "--json" && has_value) json = argv[++i];
+        else {
+            std::cerr << "usage: shell_pty [--shell PATH] [--runs N] [--filter PREFIX] [--json FILE]\n";
+            return 2;
+        }
+    }
+    if(access(setup.shell.c_str(), X_OK) != 0) {
+        std::cerr << "shell_pty: " << setup.shell << ": " << std::strerror(errno) << '\n';
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    setup.prepare();
+
+    std::vector<std::pair<std::string, std::function<void(Scenario&)>>> all = {
+        {"startup", [&](Scenario &s) { startup(setup, s, runs); }},
+        {"keystroke-echo", [&](Scenario &s) { keystroke_echo(setup, s, std::max<size_t>(1, runs / 4)); }},
+        {"tab", [&](Scenario &s) { tab(setup, s, runs); }},
+        {"double-tab", [&](Scenario &s) { double_tab(setup, s, runs); }},
+        {"arrows", [&](Scenario &s) { arrows(setup, s, runs); }},
+        {"ctrl-r", [&](Scenario &s) { search(setup, s, runs); }},
+        {"script-builtins", [&](Scenario &s) { script(setup, s, 3, "echo line", 20000); }},
+        {"script-externals", [&](Scenario &s) { script(setup, s, 3, "/bin/true", 1000); }},
+        {"check-lists", [&](Scenario &s) { lists(setup, s); }},
+        {"check-fd-fallback", [&](Scenario &s) { fd_fallback(setup, s); }},
+        {"check-quoting", [&](Scenario &s) { quoting(setup, s); }},
+        {"check-exit-status", [&](Scenario &s) { exit_status(setup, s); }},
+        {"check-redirect-fds", [&](Scenario &s) { redirect_fds(setup, s); }},
+        {"check-hash", [&](Scenario &s) { hash_table(setup, s); }},
+    };
+
+    std::vector<Scenario> done;
+    for(auto &[name, body]: all) {
+        if(!name.starts_with(filter)) continue;
+        Scenario s;
+        s.name = name;
+        body(s);
+        std::vector<double> sorted = s.samples;
+        std::sort(sorted.begin(), sorted.end());
+        char line[256];
+        snprintf(line, sizeof(line), "%-18s %5zu samples  p50 %10.1f  p95 %10.1f  p99 %10.1f  max %10.1f %-5s  %s",
+                 name.c_str(), sorted.size(), percentile(sorted, 50), percentile(sorted, 95), percentile(sorted, 99),
+                 sorted.empty() ? 0.0 : sorted.back(), s.unit.c_str(), s.failure.empty() ? "ok" : ("FAIL: " + s.failure).c_str());
+        std::cout << line << std::endl;
+        s.samples = std::move(sorted);
+        done.push_back(std::move(s));
+    }
+
+    if(!json.empty()) {
+        std::ofstream out(json);
+        out << "{\"scenarios\":[\n";
+        for(size_t i = 0; i < done.size(); ++i) {
+            const Scenario &s = done[i];
+            char line[512];
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"%s\",\"unit\":\"%s\",\"samples\":%zu,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f,\"passed\":%s}%s\n",
+                     s.name.c_str(), s.unit.c_str(), s.samples.size(), percentile(s.samples, 50), percentile(s.samples, 95),
+                     percentile(s.samples, 99), s.samples.empty() ? 0.0 : s.samples.back(),
+                     s.failure.empty() ? "true" : "false", i + 1 < done.size() ? "," : "");
+            out << line;
+        }
+        out << "]}\n";
+    }
+    for(auto &s: done) if(!s.failure.empty()) return 1;
+    return 0;
+}
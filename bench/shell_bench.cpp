@@ -0,0 +1,344 @@
+// Microbenchmarks for the shell's hot paths, linked against the same code
+// the shell runs. Every benchmark is timed in batches long enough to dwarf
+// the clock, and the median of several batches is reported.
+//
+//   shell_bench [--filter PREFIX] [--quick] [--json FILE] [--compare FILE [--threshold PCT]]
+//
+// --json writes one result per line ("-" for stdout, which moves the readable
+// report to stderr); --compare reads such a file back and exits 1 if any
+// benchmark got slower by more than PCT percent.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include "parser.h"
+#include "command.h"
+#include "expand.h"
+#include "trie.h"
+#include "history.h"
+#include "path_hash.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    template<class T> void keep(const T &value) { asm volatile("" : : "g"(&value) : "memory"); }
+
+    struct Result {
+        std::string name;
+        size_t iterations;
+        double ns_per_op;
+        double bytes_per_op;
+    };
+
+    class Runner {
+    public:
+        std::string filter;
+        double batch_s = 0.05;
+        size_t batches = 5;
+        std::vector<Result> results;
+        std::ostream *report = &std::cout;   // the human-readable lines
+
+        // Whether any benchmark of a group could pass the filter, before paying for its setup.
+        bool wants(std::string_view group) const {
+            return group.starts_with(filter) || filter.starts_with(group);
+        }
+
+        // Time fn() per call; bytes (if given) turns it into a throughput too.
+        void run(const std::string &name, const std::function<void()> &fn, double bytes = 0) {
+            if(!name.starts_with(filter)) return;
+            fn();   // warm caches and lazy state
+            size_t n = 1;
+            while(true) {
+                double t = time(fn, n);
+                if(t >= batch_s / 10 || n >= (size_t(1) << 30)) {
+                    n = std::max<size_t>(1, size_t(n * batch_s / std::max(t, 1e-9)));
+                    break;
+                }
+                n *= 10;
+            }
+            std::vector<double> per_op;
+            for(size_t b = 0; b < batches; ++b) per_op.push_back(time(fn, n) * 1e9 / n);
+            std::sort(per_op.begin(), per_op.end());
+            Result r{name, n * batches, per_op[per_op.size() / 2], bytes};
+            print(r);
+            results.push_back(r);
+        }
+
+    private:
+        static double time(const std::function<void()> &fn, size_t n) {
+            auto start = Clock::now();
+            for(size_t i = 0; i < n; ++i) fn();
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        void print(const Result &r) const {
+            char line[256];
+            double ns = r.ns_per_op;
+            const char *unit = "ns";
+            if(ns >= 1e6) { ns /= 1e6; unit = "ms"; }
+            else if(ns >= 1e3) { ns /= 1e3; unit = "us"; }
+            int len = snprintf(line, sizeof(line), "%-36s %10.2f %s/op %12zu iterations", r.name.c_str(), ns, unit, r.iterations);
+            if(r.bytes_per_op > 0) {
+                snprintf(line + len, sizeof(line) - len, " %10.1f MB/s", r.bytes_per_op / r.ns_per_op * 1e3);
+            }
+            *report << line << std::endl;
+        }
+    };
+
+    // A scratch directory for the benchmarks' files, removed at exit.
+    struct Scratch {
+        fs::path dir;
+        Scratch() {
+            char tmpl[] = "/tmp/shell_bench.XXXXXX";
+            dir = mkdtemp(tmpl);
+        }
+        ~Scratch() {
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        }
+    };
+
+    void touch(const fs::path &path, mode_t mode) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, mode);
+        if(fd != -1) close(fd);
+    }
+
+    // Words as a user might type them: plain, single- and double-quoted with
+    // blanks inside, escapes, a redirection and a pipe now and then.
+    std::string quoted_line(size_t bytes) {
+        static const char *pieces[] = {
+            "grep", "-n", "'a single-quoted phrase with spaces'", "\"double $HOME \\\"quoted\\\" text\"",
+            "path/to/some\\ file.txt", "--option=value", "2>&1", "|", "sed", "'s/x/y/g'", ">out.log", "\"$1\"",
+        };
+        std::string line;
+        for(size_t i = 0; line.size() < bytes; ++i) {
+            if(!line.empty()) line += ' ';
+            line += pieces[i % std::size(pieces)];
+        }
+        return line;
+    }
+
+    void bench_tokenize(Runner &r) {
+        if(!r.wants("tokenize/")) return;
+        for(size_t size: {1u << 10, 1u << 16, 1u << 20}) {
+            std::string source = quoted_line(size), buf;
+            std::vector<uint8_t> quoting;
+            buf.reserve(source.size() + 1);
+            r.run("tokenize/" + std::to_string(size), [&] {
+                buf.assign(source);   // tokenizing rewrites the buffer
+                auto tokens = getCommandArgs(buf, &quoting);
+                keep(tokens);
+            }, double(source.size()));
+        }
+    }
+
+    void bench_parse(Runner &r) {
+        if(!r.wants("parse_input/") && !r.wants("get_argv/")) return;
+        for(size_t stages: {1u, 16u, 256u}) {
+            std::string text;
+            for(size_t i = 0; i < stages; ++i) text += (i ? " | " : "") + std::string("cmd arg1 'arg two' \"arg3\" >f");
+            auto line = std::make_shared<std::string>(text);
+            auto tokens = getCommandArgs(*line);
+            r.run("parse_input/" + std::to_string(stages) + "-stages", [&] {
+                auto pipeline = parse_input(line, tokens);
+                keep(pipeline);
+            });
+        }
+        for(size_t args: {16u, 1024u, 65536u}) {
+            std::string text = "cmd";
+            for(size_t i = 1; i < args; ++i) text += (i % 16 == 0) ? " 2>>err.log" : " argument" + std::to_string(i);
+            auto line = std::make_shared<std::string>(text);
+            auto tokens = getCommandArgs(*line);
+            auto pipeline = parse_input(line, tokens);
+            Command &cmd = pipeline[0];
+            r.run("get_argv/" + std::to_string(args) + "-args", [&] {
+                cmd.get_argv();
+                keep(cmd.argv);
+            });
+        }
+    }
+
+    void bench_expand(Runner &r, const fs::path &scratch) {
+        if(!r.wants("expand/")) return;
+        fs::path logs = scratch / "logs";
+        fs::create_directory(logs);
+        for(size_t i = 0; i < 10000; ++i) {
+            touch(logs / ("app-" + std::to_string(i) + (i % 2 ? ".log" : ".txt")), 0644);
+        }
+        for(std::string text: {std::string("echo $HOME/{a,b,c}/${USER}-x ~ ~/y"), "ls " + logs.string() + "/*.log"}) {
+            std::string buf = text;
+            std::vector<uint8_t> quoting;
+            auto tokens = getCommandArgs(buf, &quoting);
+            std::string out;
+            r.run(text.starts_with("ls") ? "expand/glob-10k-files" : "expand/braces-vars-tilde", [&] {
+                out.clear();
+                auto words = Expand::words(buf, quoting, tokens, 0, out);
+                keep(words);
+            });
+        }
+    }
+
+    // 50k executable names spread over 20 PATH directories.
+    std::vector<std::string> path_names(const fs::path &scratch, std::vector<fs::path> &dirs) {
+        std::vector<std::string> names;
+        for(size_t d = 0; d < 20; ++d) {
+            dirs.push_back(scratch / ("bin" + std::to_string(d)));
+            fs::create_directory(dirs.back());
+            for(size_t i = 0; i < 2500; ++i) {
+                names.push_back("tool" + std::to_string(d) + "-" + std::to_string(i));
+                touch(dirs.back() / names.back(), 0755);
+            }
+        }
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    void bench_path(Runner &r, const fs::path &scratch) {
+        if(!r.wants("path/") && !r.wants("trie/")) return;
+        std::vector<fs::path> dirs;
+        std::vector<std::string> names = path_names(scratch, dirs);
+
+        Trie::TrieNode root;
+        r.run("trie/build-50k", [&] { Trie::build(&root, names); });
+        r.run("trie/complete-prefix", [&] {
+            auto c = Trie::complete(&root, "tool1");
+            keep(c);
+        });
+        r.run("trie/list-all-50k", [&] {
+            Trie::Completions it(&root, "");
+            std::string word;
+            size_t n = 0;
+            while(it.next(word)) n++;
+            keep(n);
+        });
+
+        PathHash::init(dirs);
+        std::string first = "tool0-7", last = "tool19-7", missing = "no-such-tool";
+        r.run("path/search-first-dir", [&] { keep(PathHash::search_path(first)); });
+        r.run("path/search-last-dir", [&] { keep(PathHash::search_path(last)); });
+        r.run("path/search-miss", [&] { keep(PathHash::search_path(missing)); });
+        PathHash::find(last);
+        r.run("path/find-hashed", [&] {
+            PathHash::sync();
+            keep(PathHash::find(last));
+        });
+    }
+
+    void bench_history(Runner &r, const fs::path &scratch) {
+        if(!r.wants("history/")) return;
+        fs::path file = scratch / "history", copy = scratch / "history.out";
+        {
+            std::ofstream out(file);
+            for(size_t i = 0; i < 1000000; ++i) out << "git commit -m 'change number " << i << "' --author=dev" << i % 97 << '\n';
+        }
+        double bytes = double(fs::file_size(file));
+        std::string limit = "-1";   // keep all of them
+        r.run("history/load-1M", [&] {
+            HISTORY::Store store;
+            store.set_limits(limit.c_str(), limit.c_str());
+            store.load(file);
+            keep(store.size());
+        }, bytes);
+        r.run("history/read-1M", [&] {
+            HISTORY::Store store;
+            store.set_limits(limit.c_str(), limit.c_str());
+            store.read(file);
+            keep(store.size());
+        }, bytes);
+        HISTORY::Store store;
+        store.set_limits(limit.c_str(), limit.c_str());
+        store.read(file);
+        r.run("history/write-1M", [&] { store.write(copy); }, bytes);
+    }
+
+    // name -> ns/op from a --json file.
+    std::map<std::string, double> read_results(const std::string &file) {
+        std::map<std::string, double> out;
+        std::ifstream in(file);
+        std::string line;
+        while(std::getline(in, line)) {
+            size_t n = line.find("\"name\":\""), t = line.find("\"ns_per_op\":");
+            if(n == std::string::npos || t == std::string::npos) continue;
+            n += 8;
+            out[line.substr(n, line.find('"', n) - n)] = std::strtod(line.c_str() + t + 12, nullptr);
+        }
+        return out;
+    }
+
+    void write_results(std::ostream &out, const std::vector<Result> &results) {
+        out << "{\"benchmarks\":[\n";
+        char line[512];
+        for(size_t i = 0; i < results.size(); ++i) {
+            const Result &r = results[i];
+            snprintf(line, sizeof(line), "{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.3f,\"bytes_per_second\":%.0f}%s\n",
+                     r.name.c_str(), r.iterations, r.ns_per_op, r.bytes_per_op > 0 ? r.bytes_per_op / r.ns_per_op * 1e9 : 0.0,
+                     i + 1 < results.size() ? "," : "");
+            out << line;
+        }
+        out << "]}\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Runner runner;
+    std::string json, compare;
+    double threshold = 10;
+    for(int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(arg == "--filter" && has_value) runner.filter = argv[++i];
+        else if(arg == "--json" && has_value) json = argv[++i];
+        else if(arg == "--compare" && has_value) compare = argv[++i];
+        else if(arg == "--threshold" && has_value) threshold = std::strtod(argv[++i], nullptr);
+        else if(arg == "--quick") {
+            runner.batch_s = 0.01;
+            runner.batches = 3;
+        } else {
+            std::cerr << "usage: shell_bench [--filter PREFIX] [--quick] [--json FILE] [--compare FILE [--threshold PCT]]\n";
+            return 2;
+        }
+    }
+
+    if(json == "-") runner.report = &std::cerr;
+    Scratch scratch;
+    bench_tokenize(runner);
+    bench_parse(runner);
+    bench_expand(runner, scratch.dir);
+    bench_path(runner, scratch.dir);
+    bench_history(runner, scratch.dir);
+
+    if(json == "-") write_results(std::cout, runner.results);
+    else if(!json.empty()) {
+        std::ofstream out(json);
+        write_results(out, runner.results);
+        if(!out) {
+            std::cerr << "shell_bench: " << json << ": cannot write\n";
+            return 2;
+        }
+    }
+
+    if(compare.empty()) return 0;
+    auto baseline = read_results(compare);
+    int regressions = 0;
+    for(auto &r: runner.results) {
+        auto it = baseline.find(r.name);
+        if(it == baseline.end() || it->second <= 0) continue;
+        double change = (r.ns_per_op / it->second - 1) * 100;
+        char line[256];
+        snprintf(line, sizeof(line), "%-36s %+7.1f%%%s", r.name.c_str(), change, change > threshold ? "  REGRESSION" : "");
+        *runner.report << line << std::endl;
+        regressions += change > threshold;
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#include "bench.h"
+#include "trace.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <charconv>
+
+namespace Bench {
+    struct Sample {
+        double wall_ms, user_ms, sys_ms;
+        int status;
+    };
+
+    struct Summary {
+        double mean = 0, stddev = 0, min = 0, p50 = 0, p95 = 0, max = 0;
+        double user_mean = 0, sys_mean = 0;
+        size_t outliers = 0, failed = 0;
+    };
+
+    static bool number(std::string_view text, size_t &out) {
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+        return ec == std::errc() && end == text.data() + text.size();
+    }
+
+    bool parse(std::span<const std::string_view> tokens, Options &opts, size_t &start) {
+        size_t i = 1;
+        for(; i < tokens.size() && tokens[i].starts_with("-"); ++i) {
+            std::string_view arg = tokens[i];
+            if(arg == "--") {
+                ++i;
+                break;
+            }
+            if(arg != "-n" && arg != "-w" && arg != "-c" && arg != "-j") {
+                std::cerr << "bench: " << arg << ": invalid option\n";
+                return false;
+            }
+            if(i + 1 >= tokens.size()) {
+                std::cerr << "bench: " << arg << ": option requires an argument\n";
+                return false;
+            }
+            std::string_view value = tokens[++i];
+            if(arg == "-c") opts.csv = value;
+            else if(arg == "-j") opts.json = value;
+            else if(!number(value, arg == "-n" ? opts.runs : opts.warmup) || (arg == "-n" && opts.runs == 0)) {
+                std::cerr << "bench: " << value << ": invalid number of runs\n";
+                return false;
+            }
+        }
+        if(i >= tokens.size()) {
+            std::cerr << "usage: bench [-n N] [-w W] [-c FILE] [-j FILE] [--] pipeline\n";
+            return false;
+        }
+        start = i;
+        return true;
+    }
+
+    // Nearest rank, as in `parallel --stats`.
+    static double percentile(const std::vector<double> &sorted, double p) {
+        if(sorted.empty()) return 0;
+        size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    static Summary summarize(const std::vector<Sample> &samples) {
+        Summary s;
+        if(samples.empty()) return s;
+        std::vector<double> wall;
+        for(auto &x: samples) {
+            wall.push_back(x.wall_ms);
+            s.mean += x.wall_ms;
+            s.user_mean += x.user_ms;
+            s.sys_mean += x.sys_ms;
+            s.failed += x.status != 0;
+        }
+        size_t n = samples.size();
+        s.mean /= n;
+        s.user_mean /= n;
+        s.sys_mean /= n;
+        for(double w: wall) s.stddev += (w - s.mean) * (w - s.mean);
+        s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0;
+        std::sort(wall.begin(), wall.end());
+        s.min = wall.front();
+        s.max = wall.back();
+        s.p50 = percentile(wall, 50);
+        s.p95 = percentile(wall, 95);
+
+        // Modified z-score (Iglewicz and Hoaglin): distance from the median in
+        // units of the median absolute deviation, robust to the outliers themselves.
+        double median = n % 2 ? wall[n / 2] : (wall[n / 2 - 1] + wall[n / 2]) / 2;
+        std::vector<double> dev;
+        for(double w: wall) dev.push_back(std::fabs(w - median));
+        std::sort(dev.begin(), dev.end());
+        double mad = n % 2 ? dev[n / 2] : (dev[n / 2 - 1] + dev[n / 2]) / 2;
+        if(mad > 0) {
+            for(double w: wall) s.outliers += 0.6745 * std::fabs(w - median) / mad > 3.5;
+        }
+        return s;
+    }
+
+    static std::string json_string(std::string_view text) {
+        std::string out = "\"";
+        for(unsigned char c: text) {
+            if(c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if(c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else out += c;
+        }
+        return out + '"';
+    }
+
+    static void write_csv(const std::string &file, const std::vector<Sample> &samples) {
+        std::ofstream out(file);
+        out << "run,wall_ms,user_ms,sys_ms,status\n";
+        char line[128];
+        for(size_t i = 0; i < samples.size(); ++i) {
+            snprintf(line, sizeof(line), "%zu,%.4f,%.4f,%.4f,%d\n", i + 1, samples[i].wall_ms,
+                     samples[i].user_ms, samples[i].sys_ms, samples[i].status);
+            out << line;
+        }
+        if(!out) std::cerr << "bench: " << file << ": cannot write\n";
+    }
+
+    static void write_json(const std::string &file, std::string_view label, const Options &opts,
+                           const std::vector<Sample> &samples, const Summary &s) {
+        std::ofstream out(file);
+        char buf[512];
+        out << "{\"command\":" << json_string(label) << ",\"warmup\":" << opts.warmup << ",\"runs\":[";
+        for(size_t i = 0; i < samples.size(); ++i) {
+            snprintf(buf, sizeof(buf), "%s{\"wall_ms\":%.4f,\"user_ms\":%.4f,\"sys_ms\":%.4f,\"status\":%d}",
+                     i ? "," : "", samples[i].wall_ms, samples[i].user_ms, samples[i].sys_ms, samples[i].status);
+            out << buf;
+        }
+        snprintf(buf, sizeof(buf),
+                 "],\"summary\":{\"mean_ms\":%.4f,\"stddev_ms\":%.4f,\"min_ms\":%.4f,\"p50_ms\":%.4f,"
+                 "\"p95_ms\":%.4f,\"max_ms\":%.4f,\"user_mean_ms\":%.4f,\"sys_mean_ms\":%.4f,"
+                 "\"outliers\":%zu,\"failed\":%zu}}\n",
+                 s.mean, s.stddev, s.min, s.p50, s.p95, s.max, s.user_mean, s.sys_mean, s.outliers, s.failed);
+        out << buf;
+        if(!out) std::cerr << "bench: " << file << ": cannot write\n";
+    }
+
+    void run(const Options &opts, std::string_view label, const std::function<bool(int &status)> &once) {
+        std::vector<Sample> samples;
+        samples.reserve(opts.runs);
+        for(size_t i = 0; i < opts.warmup + opts.runs; ++i) {
+            uint64_t user0, sys0, user1, sys1;
+            Trace::child_times(user0, sys0);
+            uint64_t start = Trace::now_ns();
+            int status = 0;
+            bool go_on = once(status);
+            uint64_t end = Trace::now_ns();
+            Trace::child_times(user1, sys1);
+            if(i >= opts.warmup) samples.push_back({(end - start) / 1e6, (user1 - user0) / 1e3, (sys1 - sys0) / 1e3, status});
+            if(!go_on) break;
+        }
+        if(samples.empty()) return;
+        Summary s = summarize(samples);
+
+        char line[256];
+        std::cout << "bench: " << label << '\n';
+        snprintf(line, sizeof(line), "  %zu runs, %zu warmup: %.3f ms ± %.3f ms (user %.3f ms, sys %.3f ms)\n",
+                 samples.size(), opts.warmup, s.mean, s.stddev, s.user_mean, s.sys_mean);
+        std::cout << line;
+        snprintf(line, sizeof(line), "  min %.3f ms, p50 %.3f ms, p95 %.3f ms, max %.3f ms\n", s.min, s.p50, s.p95, s.max);
+        std::cout << line;
+        if(s.outliers) {
+            std::cout << "  " << s.outliers << (s.outliers == 1 ? " outlier" : " outliers")
+                      << " (modified z-score > 3.5); consider more warmup runs or a quieter machine\n";
+        }
+        if(s.failed) std::cout << "  " << s.failed << " of " << samples.size() << " runs exited non-zero\n";
+
+        if(!opts.csv.empty()) write_csv(opts.csv, samples);
+        if(!opts.json.empty()) write_json(opts.json, label, opts, samples, s);
+    }
+}
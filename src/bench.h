@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <span>
+#include <functional>
+
+// `bench [-n N] [-w W] [-c FILE] [-j FILE] [--] pipeline`
+//
+// Runs the rest of the line N times (after W untimed warmup runs) through
+// the shell's own pipeline code, so no harness process sits in between.
+// Each run records wall time and the user/sys CPU of the children it
+// reaped (wait4 rusage). The summary gives mean ± stddev, min, p50, p95
+// and max, and flags outliers by modified z-score; -c and -j write every
+// run plus the summary as CSV or JSON for comparing builds.
+namespace Bench {
+    struct Options {
+        size_t runs = 10;
+        size_t warmup = 0;
+        std::string csv, json;   // export files, empty = none
+    };
+
+    // Parse bench's own options from tokens (tokens[0] is "bench"). On success
+    // `start` is the index of the pipeline's first token. Returns false after
+    // printing a usage error to std::cerr.
+    bool parse(std::span<const std::string_view> tokens, Options &opts, size_t &start);
+
+    // Call `once` warmup + runs times and print the summary to std::cout.
+    // `once` returns false to stop early (the shell is exiting, or a run was
+    // interrupted); the runs done so far are still reported.
+    void run(const Options &opts, std::string_view label, const std::function<bool(int &status)> &once);
+}
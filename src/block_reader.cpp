@@ -0,0 +1,39 @@
+#include "block_reader.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+BlockReader::BlockReader(int fd) : fd(fd) {}
+
+BlockReader::BlockReader(std::string data) : fd(-1), eof(true), buf(std::move(data)) {}
+
+bool BlockReader::next(std::string_view &line) {
+    while(true) {
+        const char* start = buf.data() + pos;
+        size_t avail = buf.size() - pos;
+        if(const void* nl = std::memchr(start, '\n', avail)) {
+            size_t len = static_cast<const char*>(nl) - start;
+            line = std::string_view(start, len);
+            pos += len + 1;
+            return true;
+        }
+        if(eof) {
+            if(avail == 0) return false;
+            // Last line without a trailing newline.
+            line = std::string_view(start, avail);
+            pos = buf.size();
+            return true;
+        }
+        // Drop consumed bytes, then append one more block after the partial line.
+        buf.erase(0, pos);
+        pos = 0;
+        size_t old = buf.size();
+        buf.resize(old + BLOCK_SIZE);
+        ssize_t n;
+        do {
+            n = read(fd, buf.data() + old, BLOCK_SIZE);
+        } while(n < 0 && errno == EINTR);
+        buf.resize(old + (n > 0 ? n : 0));
+        if(n <= 0) eof = true;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Line source for non-interactive input (scripts, -c, piped stdin).
+// Reads in large blocks and finds line ends with memchr, which glibc
+// implements with SIMD compares, instead of pulling one byte at a time.
+class BlockReader {
+public:
+    static const size_t BLOCK_SIZE = 1 << 16;
+
+    explicit BlockReader(int fd);
+    explicit BlockReader(std::string data);  // in-memory source, e.g. `-c` text
+
+    // Next line without its '\n'. The view stays valid until the next call.
+    bool next(std::string_view &line);
+
+private:
+    int fd;
+    bool eof = false;
+    std::string buf;
+    size_t pos = 0;    // start of unconsumed data in buf
+};
@@ -0,0 +1,105 @@
+#include "builtins.h"
+#include <iostream>
+#include <unordered_map>
+#include <dlfcn.h>
+
+namespace Builtins {
+    struct Loaded {
+        Function fn;
+        void *handle;
+        std::string file;
+    };
+
+    // Only the shell's main thread loads or looks up; stage threads get the
+    // function pointer itself.
+    static std::unordered_map<std::string, Loaded> table;
+    static std::vector<std::string> order;   // load order, for listing
+    static uint64_t changes = 0;
+
+    Function loaded(std::string_view name) {
+        if(table.empty()) return nullptr;
+        auto it = table.find(std::string(name));
+        return it == table.end() ? nullptr : it->second.fn;
+    }
+
+    bool is_builtin(std::string_view name) {
+        return lookup(name) != NONE || loaded(name);
+    }
+
+    std::vector<std::string> names() {
+        std::vector<std::string> out(NAMES.begin(), NAMES.end());
+        out.insert(out.end(), order.begin(), order.end());
+        return out;
+    }
+
+    uint64_t generation() { return changes; }
+
+    static bool load(const char *file, const std::string &name) {
+        if(lookup(name) != NONE) {
+            std::cerr << "enable: " << name << ": a core builtin can't be replaced\n";
+            return false;
+        }
+        // Kept open for the life of the shell, so nothing is ever unmapped
+        // under a stage thread still running it.
+        void *handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+        if(!handle) {
+            std::cerr << "enable: " << dlerror() << '\n';
+            return false;
+        }
+        std::string symbol = name + "_builtin";
+        auto fn = reinterpret_cast<Function>(dlsym(handle, symbol.c_str()));
+        if(!fn) {
+            std::cerr << "enable: " << file << ": no " << symbol << " in it\n";
+            return false;
+        }
+        if(!table.count(name)) order.push_back(name);
+        table[name] = {fn, handle, file};
+        changes++;
+        return true;
+    }
+
+    static bool remove(const std::string &name) {
+        if(!table.erase(name)) {
+            std::cerr << "enable: " << name << ": not a loaded builtin\n";
+            return false;
+        }
+        std::erase(order, name);
+        changes++;
+        return true;
+    }
+
+    int enable_builtin(const std::vector<char*> &argv) {
+        size_t i = 1;
+        const char *file = nullptr;
+        bool unload = false;
+        for(; argv[i] && argv[i][0] == '-'; ++i) {
+            std::string_view opt = argv[i];
+            if(opt == "-f" && argv[i + 1]) {
+                file = argv[++i];
+            } else if(opt == "-d") {
+                unload = true;
+            } else {
+                std::cerr << "enable: " << opt << ": invalid option\n"
+                          << "enable: usage: enable [-f FILE name...] [-d name...]\n";
+                return 2;
+            }
+        }
+        if(!argv[i]) {
+            for(auto name: NAMES) std::cout << "enable " << name << '\n';
+            for(auto &name: order) std::cout << "enable " << name << "\t(" << table[name].file << ")\n";
+            return 0;
+        }
+        int status = 0;
+        for(; argv[i]; ++i) {
+            bool ok = true;
+            if(unload) ok = remove(argv[i]);
+            else if(file) ok = load(file, argv[i]);
+            else if(lookup(argv[i]) == NONE && !loaded(argv[i])) {
+                std::cerr << "enable: " << argv[i] << ": not a shell builtin\n";
+                ok = false;
+            }
+            if(!ok) status = 1;
+        }
+        return status;
+    }
+}
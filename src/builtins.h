@@ -0,0 +1,88 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+// Builtin registry. The core builtins are found through a perfect hash that
+// is searched for at compile time: one FNV-1a pass over the name, a table
+// load and a single compare, instead of a scan over every name.
+//
+// More builtins can be loaded from shared objects (`enable -f lib.so name`).
+// They run in-process as a streaming stage on a thread of their own, like
+// cat/head/tee/wc, with the stage's fds after pipes and redirections.
+namespace Builtins {
+    enum Id : uint8_t {
+        // CMD_ because termios.h defines ECHO.
+        CMD_PWD, CMD_EXIT, CMD_TYPE, CMD_ECHO, CMD_CD, CMD_HISTORY, CMD_HASH, CMD_CAT, CMD_HEAD,
+        CMD_TEE, CMD_WC, CMD_JOBS, CMD_FG, CMD_BG, CMD_WAIT, CMD_PARALLEL, CMD_TRACE, CMD_BENCH,
+        CMD_ENABLE, COUNT,
+        NONE = 0xff,
+    };
+
+    inline constexpr std::array<std::string_view, COUNT> NAMES = {
+        "pwd", "exit", "type", "echo", "cd", "history", "hash", "cat", "head", "tee", "wc",
+        "jobs", "fg", "bg", "wait", "parallel", "trace", "bench", "enable",
+    };
+
+    constexpr uint32_t hash(std::string_view name, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for(char c: name) h = (h ^ uint8_t(c)) * 16777619u;
+        return h;
+    }
+
+    inline constexpr unsigned TABLE_BITS = 6;
+
+    // First seed under which no two names share a slot.
+    consteval uint32_t find_seed() {
+        for(uint32_t seed = 0; seed < 100000; ++seed) {
+            std::array<bool, 1 << TABLE_BITS> used{};
+            bool clash = false;
+            for(auto name: NAMES) {
+                uint32_t slot = hash(name, seed) >> (32 - TABLE_BITS);
+                clash |= used[slot];
+                used[slot] = true;
+            }
+            if(!clash) return seed;
+        }
+        throw "no perfect hash seed; raise TABLE_BITS";
+    }
+
+    inline constexpr uint32_t SEED = find_seed();
+
+    inline constexpr std::array<uint8_t, 1 << TABLE_BITS> TABLE = [] {
+        std::array<uint8_t, 1 << TABLE_BITS> table{};
+        table.fill(NONE);
+        for(size_t i = 0; i < COUNT; ++i) table[hash(NAMES[i], SEED) >> (32 - TABLE_BITS)] = uint8_t(i);
+        return table;
+    }();
+
+    // The core builtin called `name`, or NONE.
+    constexpr Id lookup(std::string_view name) {
+        uint8_t id = TABLE[hash(name, SEED) >> (32 - TABLE_BITS)];
+        return id != NONE && NAMES[id] == name ? Id(id) : NONE;
+    }
+
+    static_assert(lookup("echo") == CMD_ECHO && lookup("enable") == CMD_ENABLE && lookup("echoo") == NONE);
+
+    // What a shared object exports as `<name>_builtin` (extern "C"). argv is
+    // NUL-terminated; the fds are borrowed. Returns an exit status.
+    using Function = int (*)(int argc, char **argv, int in_fd, int out_fd, int err_fd);
+
+    // The loaded builtin called `name`, or nullptr.
+    Function loaded(std::string_view name);
+
+    // Core or loaded.
+    bool is_builtin(std::string_view name);
+
+    // Every builtin name, core first, for `type` and completion.
+    std::vector<std::string> names();
+    // Bumped whenever a builtin is loaded or removed, so the completion
+    // index can tell it is out of date.
+    uint64_t generation();
+
+    // enable [-f FILE name...] [-d name...]; no arguments lists the builtins.
+    // Returns an exit status.
+    int enable_builtin(const std::vector<char*> &argv);
+}
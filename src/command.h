@@ -1,5 +1,8 @@
 #pragma once
 #include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <fcntl.h>
 #include <unistd.h>
@@ -13,122 +16,299 @@
   #include <sys/types.h>
   #include <sys/wait.h>
   #include <termios.h>
+  #include <spawn.h>
+  #include <sys/mman.h>
 #endif
+#include <cstring>
+#include <cerrno>
+#include "trace.h"
+
+// One redirection, in the order written. fd is the command's descriptor.
+struct Redirect {
+  enum Kind { OPEN, DUP, CLOSE, DATA };
+  Kind kind = OPEN;
+  int fd = 0;
+  int flags = 0;                            // OPEN
+  std::string_view path;                    // OPEN: NUL-terminated, in the line buffer
+  int from = -1;                            // DUP
+  bool heredoc = false;                     // DATA from `<<` (else `<<<`)
+  std::shared_ptr<const std::string> data;  // DATA
+  int source = -1;                          // OPEN / DATA: shell-side fd, see open_redirects()
+};
+
+// Here-doc bodies read for one input line, handed out in the order their `<<`s appear.
+struct HereDocs {
+  std::vector<std::shared_ptr<const std::string>> bodies;
+  size_t next = 0;
+};
+
+// One write() per diagnostic. parallel sets up its tasks on a thread of its
+// own, and a line written piecewise through std::cerr can interleave there.
+inline void report_error(const std::string &msg) {
+  std::string line = msg + '\n';
+  (void)!write(STDERR_FILENO, line.data(), line.size());
+}
+
+// Descriptors the shell opens for redirections sit at or above this, clear of
+// the single-digit fds a redirection can name, so later dup2s can't clobber them.
+constexpr int REDIRECT_FD_BASE = 10;
 
 struct Command {
-  std::vector<std::string> args;
-  std::string out_file;
+  // The unescaped input line. args are NUL-terminated slices of it and argv
+  // points at the same bytes, so moving or sharing a Command never rebuilds them.
+  std::shared_ptr<const std::string> line;
+  std::vector<std::string_view> args;
   std::vector<char*> argv;
+  std::vector<Redirect> redirects;
 
-  int saved_out = -1;
-  int saved_err = -1;
-
-  bool should_out_redirect = false;
-  bool should_err_redirect = false;
-  bool append_redirect = false;
-  bool err_append_redirect = false;
-  
   Command() = default;
+  Command(Command&&) = default;
+  Command& operator=(Command&&) = default;
 
-    // 2. Custom Copy Constructor
-    Command(const Command& other) {
-        // Copy all the standard data
-        this->args = other.args;
-        this->out_file = other.out_file;
-        this->saved_out = other.saved_out;
-        this->saved_err = other.saved_err;
-        this->should_out_redirect = other.should_out_redirect;
-        this->should_err_redirect = other.should_err_redirect;
-        this->append_redirect = other.append_redirect;
-        this->err_append_redirect = other.err_append_redirect;
-
-        // REBUILD the pointers to point to OUR args, not 'other's args
-        this->get_argv(); 
-    }
+  // No implicit copies; share() is the explicit (and cheap) way to get one.
+  Command(const Command&) = delete;
+  Command& operator=(const Command&) = delete;
+
+  Command share() const {
+    Command other;
+    other.line = line;
+    other.args = args;
+    other.argv = argv;
+    other.redirects = redirects;
+    for(auto &r: other.redirects) r.source = -1;
+    return other;
+  }
 
-    // 3. Custom Copy Assignment Operator (for cmd1 = cmd2)
-    Command& operator=(const Command& other) {
-        if (this != &other) {
-            this->args = other.args;
-            this->out_file = other.out_file;
-            this->saved_out = other.saved_out;
-            this->saved_err = other.saved_err;
-            this->should_out_redirect = other.should_out_redirect;
-            this->should_err_redirect = other.should_err_redirect;
-            this->append_redirect = other.append_redirect;
-            this->err_append_redirect = other.err_append_redirect;
-
-            this->get_argv(); // Rebuild pointers
+  // Redirection operators, longest first where one is a prefix of another.
+  static constexpr std::string_view REDIRECT_OPS[] = {
+    "<<<", "<<-", "<<", "<>", "<&", "<", ">>", ">&", ">|", ">", "&>>", "&>",
+  };
+
+  // Every operator, bare and after each fd digit, NUL-terminated one after
+  // another. The tokenizer emits unquoted redirections as views of this table,
+  // and nothing else is one: `">"`, or an expansion that yields `>`, is a word.
+  static const std::string &redirect_table() {
+    static const std::string table = [] {
+      std::string t;
+      for(char fd: std::string_view("\0" "0123456789", 11)) {
+        for(std::string_view op: REDIRECT_OPS) {
+          if(fd) t += fd;
+          t += op;
+          t += '\0';
         }
-        return *this;
+      }
+      return t;
+    }();
+    return table;
+  }
+
+  static bool is_redirect_token(std::string_view tok) {
+    const std::string &table = redirect_table();
+    return tok.data() >= table.data() && tok.data() < table.data() + table.size();
+  }
+
+  // The table's view of `spelling`, or an empty view if it isn't an operator.
+  static std::string_view redirect_token(std::string_view spelling) {
+    std::string_view table = redirect_table();
+    for(size_t at = 0; at < table.size(); ) {
+      std::string_view entry(table.data() + at);
+      if(entry == spelling) return entry;
+      at += entry.size() + 1;
     }
+    return {};
+  }
+
+  // If `tok` starts with a redirection operator, fill in r (kind, fd, flags)
+  // and return the operator's length; otherwise 0. `&>` comes back as OPEN
+  // on fd 1 with from == 1 to say fd 2 follows it.
+  static size_t redirect_op(std::string_view tok, Redirect &r) {
+    size_t pos = 0;
+    bool has_fd = false;
+    r = Redirect();
+    if(tok.size() >= 2 && tok[0] >= '0' && tok[0] <= '9' && (tok[1] == '<' || tok[1] == '>')) {
+      r.fd = tok[0] - '0';
+      has_fd = true;
+      pos = 1;
+    }
+    std::string_view op = tok.substr(pos);
+    auto take = [&](std::string_view o, Redirect::Kind kind, int fd, int flags) {
+      r.kind = kind;
+      if(!has_fd) r.fd = fd;
+      r.flags = flags;
+      return pos + o.size();
+    };
+    if(op.starts_with("<<<") && !has_fd) return take("<<<", Redirect::DATA, 0, 0);
+    if(op.starts_with("<<")) {
+      size_t n = take(op.starts_with("<<-") ? "<<-" : "<<", Redirect::DATA, 0, 0);
+      r.heredoc = true;
+      return n;
+    }
+    if(op.starts_with("<>")) return take("<>", Redirect::OPEN, 0, O_RDWR | O_CREAT);
+    if(op.starts_with("<&")) return take("<&", Redirect::DUP, 0, 0);
+    if(op.starts_with("<")) return take("<", Redirect::OPEN, 0, O_RDONLY);
+    if(op.starts_with(">>")) return take(">>", Redirect::OPEN, 1, O_WRONLY | O_CREAT | O_APPEND);
+    if(op.starts_with(">&")) return take(">&", Redirect::DUP, 1, 0);
+    if(op.starts_with(">|")) return take(">|", Redirect::OPEN, 1, O_WRONLY | O_CREAT | O_TRUNC);
+    if(op.starts_with(">")) return take(">", Redirect::OPEN, 1, O_WRONLY | O_CREAT | O_TRUNC);
+    if(!has_fd && op.starts_with("&>>")) { size_t n = take("&>>", Redirect::OPEN, 1, O_WRONLY | O_CREAT | O_APPEND); r.from = 1; return n; }
+    if(!has_fd && op.starts_with("&>")) { size_t n = take("&>", Redirect::OPEN, 1, O_WRONLY | O_CREAT | O_TRUNC); r.from = 1; return n; }
+    return 0;
+  }
 
-  void get_argv() {
+  // Split args into argv and the redirection list. Operators (tokens from
+  // redirect_table) may be anywhere; each takes the next word as its target.
+  // Returns false, after printing why, on a missing target.
+  bool get_argv(HereDocs *docs = nullptr) {
+    Trace::Span span("get_argv");
     argv.clear();
+    redirects.clear();
+    argv.reserve(args.size() + 1);
     for(size_t i = 0; i < args.size(); ++i) {
-      if (args[i] == ">" || args[i] == "1>") {
-        should_out_redirect = true;
-        if (i + 1 < args.size()) {
-            out_file = args[i + 1]; // Get file following the operator
-        }
-        break; // Stop adding to argv once redirection starts
-      } else if (args[i] == ">>" || args[i] == "1>>") {
-        append_redirect = true;
-        if (i + 1 < args.size()) {
-            out_file = args[i + 1]; // Get file following the operator
-        }
-        break; // Stop adding to argv once redirection starts
-      } else if (args[i] == "2>") {
-        should_err_redirect = true;
-        if (i + 1 < args.size()) {
-            out_file = args[i + 1]; // Get file following the operator
-        }
-        break; // Stop adding to argv once redirection starts
-      } else if (args[i] == "2>>") {
-        err_append_redirect = true;
-        if (i + 1 < args.size()) {
-            out_file = args[i + 1]; // Get file following the operator
+      Redirect r;
+      if(!is_redirect_token(args[i])) {
+        argv.push_back(const_cast<char*>(args[i].data()));
+        continue;
+      }
+      redirect_op(args[i], r);
+      if(i + 1 == args.size() || is_redirect_token(args[i + 1])) {
+        report_error("syntax error near unexpected token `" + std::string(i + 1 == args.size() ? "newline" : args[i + 1]) + "'");
+        argv.assign(1, nullptr);
+        return false;
+      }
+      std::string_view target = args[++i];
+      bool both = r.kind == Redirect::OPEN && r.from == 1;
+      if(r.kind == Redirect::DUP) {
+        if(target == "-") {
+          r.kind = Redirect::CLOSE;
+        } else if(target.size() == 1 && target[0] >= '0' && target[0] <= '9') {
+          r.from = target[0] - '0';
+        } else if(r.fd == 1) {
+          // `>&file` is `&>file`
+          r.kind = Redirect::OPEN;
+          r.flags = O_WRONLY | O_CREAT | O_TRUNC;
+          both = true;
+        } else {
+          report_error(std::string(target) + ": ambiguous redirect");
+          argv.assign(1, nullptr);
+          return false;
         }
-        break; // Stop adding to argv once redirection starts
       }
-      argv.push_back(const_cast<char*>(args[i].c_str()));
+      if(r.kind == Redirect::OPEN) r.path = target;
+      if(r.kind == Redirect::DATA && r.heredoc) {
+        if(docs && docs->next < docs->bodies.size()) r.data = docs->bodies[docs->next++];
+        else r.data = std::make_shared<const std::string>();
+      } else if(r.kind == Redirect::DATA) {
+        auto text = std::make_shared<std::string>(target);
+        *text += '\n';
+        r.data = std::move(text);
+      }
+      r.from = (r.kind == Redirect::DUP) ? r.from : -1;
+      redirects.push_back(std::move(r));
+      if(both) {
+        Redirect err;
+        err.kind = Redirect::DUP;
+        err.fd = 2;
+        err.from = 1;
+        redirects.push_back(std::move(err));
+      }
     }
     argv.push_back(nullptr);
+    return true;
+  }
+
+#ifndef _WIN32
+  // Whether fd (0-9) is open for a command before its redirections: 0-2
+  // always, others only if the shell inherited them. The shell's own
+  // descriptors (signalfd, tty, pidfds...) are close-on-exec and don't count.
+  static bool inherited(int fd) {
+    if(fd < 3) return true;
+    int flags = fcntl(fd, F_GETFD);
+    return flags != -1 && !(flags & FD_CLOEXEC);
   }
 
-  void prepare_redirection(){
-    if((should_out_redirect || append_redirect) && !out_file.empty()){
-      saved_out = open(out_file.c_str(), O_WRONLY | O_CREAT | ((should_out_redirect) ? O_TRUNC : O_APPEND), 0644);
-      if(saved_out == -1) {
-        perror("open");
+  // Open every file and here-doc the list needs, in the shell, close-on-exec
+  // and numbered from REDIRECT_FD_BASE up. Here-docs and here-strings go into
+  // a memfd: no temp file, no disk I/O, and any size without a writer thread.
+  // Returns false (with everything closed again) if one can't be opened, or
+  // if `N>&M` names an fd that isn't open at that point.
+  bool open_redirects() {
+    bool open_fds[REDIRECT_FD_BASE];
+    for(int i = 0; i < REDIRECT_FD_BASE; ++i) open_fds[i] = inherited(i);
+    for(auto &r: redirects) {
+      int fd = -1;
+      if(r.kind == Redirect::DUP && !open_fds[r.from]) {
+        report_error(std::to_string(r.from) + ": " + std::strerror(EBADF));
+        close_redirects();
+        return false;
       }
-      if(dup2(saved_out, STDOUT_FILENO) == -1){
-        perror("dup2");
+      open_fds[r.fd] = r.kind != Redirect::CLOSE;
+      if(r.kind == Redirect::OPEN) {
+        fd = open(r.path.data(), r.flags | O_CLOEXEC, 0644);
+        if(fd == -1) report_error(std::string(r.path) + ": " + std::strerror(errno));
+      } else if(r.kind == Redirect::DATA) {
+        fd = memfd_create(r.heredoc ? "here-doc" : "here-string", MFD_CLOEXEC);
+        if(fd != -1) {
+          std::string_view rest = *r.data;
+          while(!rest.empty()) {
+            ssize_t n = write(fd, rest.data(), rest.size());
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            rest.remove_prefix(n);
+          }
+          lseek(fd, 0, SEEK_SET);
+        } else {
+          report_error(std::string("here-doc: ") + std::strerror(errno));
+        }
+      } else {
+        continue;
       }
-      close(saved_out);
-    }
-    if((should_err_redirect || err_append_redirect) && !out_file.empty()){
-      saved_err = open(out_file.c_str(), O_WRONLY | O_CREAT | ((should_err_redirect) ? O_TRUNC : O_APPEND), 0644);
-      if(saved_err == -1) {
-        perror("open");
+      if(fd != -1 && fd < REDIRECT_FD_BASE) {
+        int high = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+        close(fd);
+        fd = high;
       }
-      if(dup2(saved_err, STDERR_FILENO) == -1){
-        perror("dup2");
+      if(fd == -1) {
+        close_redirects();
+        return false;
       }
-      close(saved_err);
+      r.source = fd;
     }
+    return true;
   }
 
-  void disable_redirection(){
-    std::fflush(stdout);
-    std::fflush(stderr);
-    if (saved_out != -1) {
-      dup2(saved_out, STDOUT_FILENO);
-      close(saved_out);
+  void close_redirects() {
+    for(auto &r: redirects) {
+      if(r.source != -1) close(r.source);
+      r.source = -1;
     }
-    if (saved_err != -1) {
-      dup2(saved_err, STDERR_FILENO);
-      close(saved_err);
+  }
+
+  // The list as posix_spawn file actions, applied in order after the pipe
+  // dup2s. Needs open_redirects() first.
+  void add_spawn_actions(posix_spawn_file_actions_t *actions) const {
+    for(auto &r: redirects) {
+      if(r.kind == Redirect::CLOSE) posix_spawn_file_actions_addclose(actions, r.fd);
+      else if(r.kind == Redirect::DUP) posix_spawn_file_actions_adddup2(actions, r.from, r.fd);
+      else posix_spawn_file_actions_adddup2(actions, r.source, r.fd);
     }
   }
-};
\ No newline at end of file
+
+  // The same list applied to an in-process stage's descriptor table, 0-9 as a
+  // redirection can name them. fds[] holds descriptors the caller owns (-1 =
+  // not set up: the shell's own, if inherited); replaced ones are closed.
+  // Needs open_redirects() first, which has checked every DUP source.
+  void apply_redirects(int (&fds)[REDIRECT_FD_BASE]) const {
+    for(auto &r: redirects) {
+      int fd = -1;
+      if(r.kind == Redirect::DUP) {
+        int from = fds[r.from] != -1 ? fds[r.from] : inherited(r.from) ? r.from : -1;
+        if(from != -1) fd = fcntl(from, F_DUPFD_CLOEXEC, 0);
+      } else if(r.kind != Redirect::CLOSE) {
+        fd = fcntl(r.source, F_DUPFD_CLOEXEC, 0);
+      }
+      if(fds[r.fd] != -1) close(fds[r.fd]);
+      fds[r.fd] = fd;
+    }
+  }
+#endif
+};
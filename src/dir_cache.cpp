@@ -0,0 +1,141 @@
+#include "dir_cache.h"
+#include <algorithm>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ctime>
+
+namespace DirCache {
+    // A handful of directories is plenty for one prompt's worth of Tabs.
+    static const size_t MAX_DIRS = 16;
+
+    struct Cached {
+        std::shared_ptr<const Listing> listing;
+        dev_t dev = 0;
+        ino_t ino = 0;
+        struct timespec mtime = {};
+        bool racy = true;      // read too close to mtime to trust it
+        uint64_t used = 0;
+    };
+
+    static std::unordered_map<std::string, Cached> cache;
+    static uint64_t clock_tick = 0;
+
+    static std::shared_ptr<const Listing> read_dir(int fd) {
+        auto l = std::make_shared<Listing>();
+        std::vector<char> buf(1 << 20);
+        while(true) {
+            long n = getdents64(fd, buf.data(), buf.size());
+            if(n <= 0) break;
+            for(long pos = 0; pos < n; ) {
+                auto *d = reinterpret_cast<struct dirent64*>(buf.data() + pos);
+                pos += d->d_reclen;
+                std::string_view name(d->d_name);
+                if(name == "." || name == "..") continue;
+                bool dir = d->d_type == DT_DIR;
+                if(d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+                    // Only these need a stat: the filesystem gave no type, or
+                    // it's a symlink that may point at a directory.
+                    struct stat st;
+                    dir = fstatat(fd, d->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+                }
+                l->entries.push_back({uint32_t(l->names.size()), uint32_t(name.size()), dir});
+                l->names.append(name);
+            }
+        }
+        std::string_view names = l->names;
+        std::sort(l->entries.begin(), l->entries.end(), [names](const Entry &a, const Entry &b) {
+            return names.substr(a.off, a.len) < names.substr(b.off, b.len);
+        });
+        for(auto &e: l->entries) if(e.dir) l->dirs.push_back(e);
+        return l;
+    }
+
+    static std::shared_ptr<const Listing> get(const std::string &dir) {
+        std::string key = dir.empty() ? "." : dir;
+        if(key[0] != '/') {
+            char cwd[4096];
+            if(getcwd(cwd, sizeof(cwd))) key = std::string(cwd) + "/" + key;
+        }
+        int fd = open(key.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd < 0) return nullptr;
+        struct stat st;
+        if(fstat(fd, &st) < 0) {
+            close(fd);
+            return nullptr;
+        }
+        Cached &c = cache[key];
+        c.used = ++clock_tick;
+        bool same = c.listing && c.dev == st.st_dev && c.ino == st.st_ino &&
+                    c.mtime.tv_sec == st.st_mtim.tv_sec && c.mtime.tv_nsec == st.st_mtim.tv_nsec;
+        if(same && !c.racy) {
+            close(fd);
+            return c.listing;
+        }
+        // mtime ticks coarsely, so an entry added in the same tick as our read
+        // wouldn't change it. Re-read until the listing postdates mtime by a second.
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        c.listing = read_dir(fd);
+        close(fd);
+        c.dev = st.st_dev;
+        c.ino = st.st_ino;
+        c.mtime = st.st_mtim;
+        c.racy = now.tv_sec <= st.st_mtim.tv_sec + 1;
+
+        if(cache.size() > MAX_DIRS) {
+            auto oldest = cache.begin();
+            for(auto it = cache.begin(); it != cache.end(); ++it) if(it->second.used < oldest->second.used) oldest = it;
+            if(oldest->first != key) cache.erase(oldest);
+        }
+        return cache[key].listing;
+    }
+
+    Matches match(const std::string &dir, std::string_view prefix, bool dirs_only) {
+        Matches m;
+        m.listing = get(dir);
+        if(!m.listing) return m;
+        const Listing &l = *m.listing;
+        m.list = dirs_only ? &l.dirs : &l.entries;
+        auto below = [&](std::string_view p) {
+            return std::lower_bound(m.list->begin(), m.list->end(), p, [&](const Entry &e, std::string_view v) {
+                return l.name(e) < v;
+            }) - m.list->begin();
+        };
+        m.prefix_len = prefix.size();
+        m.lo = below(prefix);
+        m.hi = std::partition_point(m.list->begin() + m.lo, m.list->end(), [&](const Entry &e) {
+            return l.name(e).starts_with(prefix);
+        }) - m.list->begin();
+        if(prefix.empty()) {
+            // Names starting with '.' sort together, ahead of '/' which no name has.
+            m.skip_lo = below(".");
+            m.skip_hi = below("/");
+        }
+        m.pos = m.lo;
+        return m;
+    }
+
+    std::string Matches::common() const {
+        if(count() == 0) return {};
+        const Listing &l = *listing;
+        size_t first = (lo == skip_lo) ? skip_hi : lo;
+        size_t last = (hi == skip_hi) ? skip_lo - 1 : hi - 1;
+        // Sorted, so what the first and last match share, they all share.
+        std::string_view a = l.name((*list)[first]), b = l.name((*list)[last]);
+        size_t n = prefix_len;
+        while(n < a.size() && n < b.size() && a[n] == b[n]) n++;
+        return std::string(a.substr(prefix_len, n - prefix_len));
+    }
+
+    bool Matches::next(std::string_view &name, bool &dir) {
+        if(pos == skip_lo && skip_lo < skip_hi) pos = skip_hi;
+        if(pos >= hi) return false;
+        const Entry &e = (*list)[pos++];
+        name = listing->name(e);
+        dir = e.dir;
+        return true;
+    }
+}
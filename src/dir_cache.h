@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Directory listings for path completion. A directory is read with
+// getdents64 and typed from d_type (no stat per entry), sorted once, and
+// reused until its mtime changes, so repeated Tabs in a huge directory
+// cost a stat() and a binary search.
+namespace DirCache {
+    struct Entry {
+        uint32_t off;   // into Listing::names
+        uint32_t len;
+        bool dir;
+    };
+
+    struct Listing {
+        std::string names;
+        std::vector<Entry> entries;   // sorted by name
+        std::vector<Entry> dirs;      // the directories among them, sorted
+        std::string_view name(const Entry &e) const { return std::string_view(names).substr(e.off, e.len); }
+    };
+
+    // The entries of `dir` starting with `prefix`, walked in order by next().
+    // Dot files only match a prefix that starts with '.'.
+    class Matches {
+    public:
+        size_t count() const { return (hi - lo) - (skip_hi - skip_lo); }
+        // Longest continuation of the prefix shared by every match.
+        std::string common() const;
+        bool next(std::string_view &name, bool &dir);
+    private:
+        friend Matches match(const std::string &dir, std::string_view prefix, bool dirs_only);
+        std::shared_ptr<const Listing> listing;
+        const std::vector<Entry> *list = nullptr;
+        size_t prefix_len = 0;
+        size_t lo = 0, hi = 0, skip_lo = 0, skip_hi = 0, pos = 0;
+    };
+
+    // `dir` is taken as typed ("" is the current directory).
+    Matches match(const std::string &dir, std::string_view prefix, bool dirs_only);
+}
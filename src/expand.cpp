@@ -0,0 +1,391 @@
+#include "expand.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace Expand {
+    // A word being expanded: its bytes and how each one was quoted.
+    struct Word {
+        std::string text, quoting;
+        void append(std::string_view t, uint8_t q) {
+            text.append(t);
+            quoting.append(t.size(), char(q));
+        }
+    };
+
+    static bool unquoted(const Word &w, size_t i) { return w.quoting[i] == UNQUOTED; }
+
+    Pattern::Pattern(std::string_view text, std::string_view quoting) {
+        dot_ok = !text.empty() && text[0] == '.';
+        for(size_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            bool active = quoting[i] == UNQUOTED;
+            if(active && c == '*') {
+                if(ops.empty() || ops.back().kind != STAR) ops.push_back({STAR, 0, 0});
+                is_magic = true;
+                continue;
+            }
+            if(active && c == '?') {
+                ops.push_back({ONE, 0, 0});
+                is_magic = true;
+                continue;
+            }
+            if(active && c == '[') {
+                // `[!a-z]` / `[^a-z]`; a `]` right after the opening is literal.
+                size_t j = i + 1;
+                bool negate = j < text.size() && (text[j] == '!' || text[j] == '^');
+                if(negate) j++;
+                size_t first = j;
+                while(j < text.size() && !(text[j] == ']' && j > first)) j++;
+                if(j < text.size()) {
+                    std::bitset<256> set;
+                    for(size_t k = first; k < j; ++k) {
+                        unsigned char lo = text[k];
+                        if(k + 2 < j && text[k+1] == '-') {
+                            for(unsigned c2 = lo; c2 <= (unsigned char)text[k+2]; ++c2) set.set(c2);
+                            k += 2;
+                        } else {
+                            set.set(lo);
+                        }
+                    }
+                    if(negate) set.flip();
+                    ops.push_back({SET, uint32_t(sets.size()), 0});
+                    sets.push_back(set);
+                    is_magic = true;
+                    i = j;
+                    continue;
+                }
+            }
+            if(ops.empty() || ops.back().kind != LIT) ops.push_back({LIT, uint32_t(lits.size()), 0});
+            lits += c;
+            ops.back().len++;
+        }
+    }
+
+    // Iterative, backtracking only to the most recent `*`: linear for the
+    // usual `*.log` / `app-*` shapes, never exponential.
+    bool Pattern::match(std::string_view s) const {
+        size_t i = 0, p = 0;
+        size_t star_op = std::string::npos, star_p = 0;
+        while(true) {
+            if(i == ops.size()) {
+                if(p == s.size()) return true;
+            } else {
+                const Op &op = ops[i];
+                switch(op.kind) {
+                    case STAR:
+                        star_op = i++;
+                        star_p = p;
+                        continue;
+                    case LIT:
+                        if(s.compare(p, op.len, lits, op.off, op.len) == 0) {
+                            p += op.len;
+                            i++;
+                            continue;
+                        }
+                        break;
+                    case ONE:
+                        if(p < s.size()) { p++; i++; continue; }
+                        break;
+                    case SET:
+                        if(p < s.size() && sets[op.off][(unsigned char)s[p]]) { p++; i++; continue; }
+                        break;
+                }
+            }
+            if(star_op == std::string::npos || star_p >= s.size()) return false;
+            p = ++star_p;
+            i = star_op + 1;
+        }
+    }
+
+    // Only a byte the user typed unquoted can start an expansion.
+    static bool special(char c, uint8_t q) {
+        if(q == UNQUOTED) return std::strchr("$*?[{~", c) != nullptr && c != '\0';
+        return q == DOUBLE_QUOTED && c == '$';
+    }
+
+    bool needed(const std::string &line, const std::vector<uint8_t> &quoting, std::span<const std::string_view> tokens) {
+        for(auto t: tokens) {
+            if(t.data() < line.data() || t.data() >= line.data() + line.size()) continue;
+            size_t off = t.data() - line.data();
+            for(size_t i = 0; i < t.size(); ++i) if(special(t[i], quoting[off + i])) return true;
+        }
+        return false;
+    }
+
+    // `pre{a,b}post` -> `preapost prebpost`, nested and repeated braces included.
+    // A brace without a top-level comma stays as typed.
+    static void braces(Word w, std::vector<Word> &out) {
+        for(size_t i = 0; i < w.text.size(); ++i) {
+            if(w.text[i] != '{' || !unquoted(w, i)) continue;
+            if(i > 0 && w.text[i-1] == '$' && w.quoting[i-1] != LITERAL) continue;  // ${VAR}
+            std::vector<size_t> commas;
+            int depth = 0;
+            size_t j = i + 1;
+            for(; j < w.text.size(); ++j) {
+                if(!unquoted(w, j)) continue;
+                char c = w.text[j];
+                if(c == '{') depth++;
+                else if(c == '}' && depth-- == 0) break;
+                else if(c == ',' && depth == 0) commas.push_back(j);
+            }
+            if(j == w.text.size() || commas.empty()) continue;
+            commas.push_back(j);
+            size_t from = i + 1;
+            for(size_t end: commas) {
+                Word n;
+                n.text = w.text.substr(0, i) + w.text.substr(from, end - from) + w.text.substr(j + 1);
+                n.quoting = w.quoting.substr(0, i) + w.quoting.substr(from, end - from) + w.quoting.substr(j + 1);
+                braces(std::move(n), out);
+                from = end + 1;
+            }
+            return;
+        }
+        out.push_back(std::move(w));
+    }
+
+    static void tilde(Word &w) {
+        if(w.text.empty() || w.text[0] != '~' || !unquoted(w, 0)) return;
+        size_t end = std::min(w.text.find('/'), w.text.size());
+        for(size_t i = 1; i < end; ++i) if(!unquoted(w, i)) return;
+        std::string user = w.text.substr(1, end - 1);
+        const char* home = nullptr;
+        if(user.empty()) {
+            home = std::getenv("HOME");
+        } else if(struct passwd *pw = getpwnam(user.c_str())) {
+            home = pw->pw_dir;
+        }
+        if(!home) return;
+        Word n;
+        n.append(home, LITERAL);
+        n.text.append(w.text, end);
+        n.quoting.append(w.quoting, end);
+        w = std::move(n);
+    }
+
+    // Substitute variables. Values from unquoted `$`s keep UNQUOTED bytes (so
+    // they glob) with blanks turned into SPLIT; quoted ones come out literal.
+    static Word variables(const Word &w, int last_status) {
+        Word n;
+        for(size_t i = 0; i < w.text.size(); ++i) {
+            char c = w.text[i];
+            uint8_t q = w.quoting[i];
+            if(c != '$' || q == LITERAL || i + 1 == w.text.size() || w.quoting[i+1] == LITERAL) {
+                n.text += c;
+                n.quoting += char(q);
+                continue;
+            }
+            std::string name, value;
+            size_t j = i + 1;
+            char next = w.text[j];
+            if(next == '{') {
+                size_t close = w.text.find('}', j);
+                if(close == std::string::npos) {
+                    n.text += c;
+                    n.quoting += char(q);
+                    continue;
+                }
+                name = w.text.substr(j + 1, close - j - 1);
+                j = close + 1;
+            } else if(next == '?' || next == '$') {
+                name = next;
+                j++;
+            } else if(std::isalpha((unsigned char)next) || next == '_') {
+                // The name ends where the quoting does: "$A"x is $A then x.
+                while(j < w.text.size() && w.quoting[j] == q && (std::isalnum((unsigned char)w.text[j]) || w.text[j] == '_')) j++;
+                name = w.text.substr(i + 1, j - i - 1);
+            } else {
+                n.text += c;
+                n.quoting += char(q);
+                continue;
+            }
+            if(name == "?") value = std::to_string(last_status);
+            else if(name == "$") value = std::to_string(getpid());
+            else if(const char* v = std::getenv(name.c_str())) value = v;
+            for(char v: value) {
+                n.text += v;
+                n.quoting += char(q == DOUBLE_QUOTED ? LITERAL : (std::isspace((unsigned char)v) ? SPLIT : UNQUOTED));
+            }
+            i = j - 1;
+        }
+        return n;
+    }
+
+    std::string variables(std::string_view text, int last_status) {
+        Word w;
+        w.append(text, DOUBLE_QUOTED);
+        return variables(w, last_status).text;
+    }
+
+    // Split on the blanks that unquoted expansions brought in. A word with a
+    // quoted part stays one field even when it comes out empty ("$UNSET").
+    static void split(Word &&w, bool quoted, std::vector<Word> &out) {
+        size_t count = out.size();
+        size_t from = 0;
+        for(size_t i = 0; i <= w.text.size(); ++i) {
+            if(i < w.text.size() && w.quoting[i] != SPLIT) continue;
+            if(i > from) out.push_back({w.text.substr(from, i - from), w.quoting.substr(from, i - from)});
+            from = i + 1;
+        }
+        if(quoted && out.size() == count) out.push_back({});
+    }
+
+    // Matches found so far, NUL-separated in one buffer.
+    struct Found {
+        std::string arena;
+        std::vector<std::pair<uint32_t, uint32_t>> at;
+        void add(const std::string &path) {
+            at.emplace_back(arena.size(), path.size());
+            arena.append(path);
+            arena += '\0';
+        }
+    };
+
+    static bool is_dir_entry(int dirfd, const struct dirent *d) {
+        if(d->d_type == DT_DIR) return true;
+        if(d->d_type != DT_UNKNOWN && d->d_type != DT_LNK) return false;
+        struct stat st;
+        return fstatat(dirfd, d->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    // Match components[k..] below `dirfd` (owned), whose path so far is `path`.
+    static void walk(int dirfd, std::string &path, const std::vector<Pattern> &components, size_t k, bool want_dir, Found &found) {
+        const Pattern &pat = components[k];
+        bool last = k + 1 == components.size();
+        size_t base = path.size();
+        if(!pat.magic()) {
+            // Literal components are looked up, not listed.
+            const std::string &name = pat.literal();
+            path += name;
+            if(last) {
+                struct stat st;
+                if(fstatat(dirfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                   (!want_dir || (fstatat(dirfd, name.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)))) {
+                    found.add(want_dir ? path + "/" : path);
+                }
+            } else {
+                int fd = openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(fd >= 0) {
+                    path += '/';
+                    walk(fd, path, components, k + 1, want_dir, found);
+                }
+            }
+            path.resize(base);
+            close(dirfd);
+            return;
+        }
+        DIR *d = fdopendir(dirfd);
+        if(!d) {
+            close(dirfd);
+            return;
+        }
+        while(struct dirent *e = readdir(d)) {
+            std::string_view name(e->d_name);
+            if(name[0] == '.' && (!pat.dotOk() || name == "." || name == "..")) continue;
+            if(!pat.match(name)) continue;
+            if(last && !want_dir) {
+                path += name;
+                found.add(path);
+                path.resize(base);
+                continue;
+            }
+            if(!is_dir_entry(dirfd, e)) continue;
+            path += name;
+            path += '/';
+            if(last) {
+                found.add(path);
+            } else {
+                int fd = openat(dirfd, e->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(fd >= 0) walk(fd, path, components, k + 1, want_dir, found);
+            }
+            path.resize(base);
+        }
+        closedir(d);
+    }
+
+    // Pathname expansion of one field. Returns false if it isn't a pattern.
+    static bool glob(const Word &w, Found &found) {
+        bool magic = false;
+        for(size_t i = 0; i < w.text.size() && !magic; ++i) {
+            magic = unquoted(w, i) && (w.text[i] == '*' || w.text[i] == '?' || w.text[i] == '[');
+        }
+        if(!magic) return false;
+
+        std::vector<Pattern> components;
+        size_t from = 0;
+        bool absolute = w.text[0] == '/';
+        bool want_dir = w.text.back() == '/';
+        for(size_t i = 0; i <= w.text.size(); ++i) {
+            if(i < w.text.size() && w.text[i] != '/') continue;
+            if(i > from) components.emplace_back(std::string_view(w.text).substr(from, i - from),
+                                                 std::string_view(w.quoting).substr(from, i - from));
+            from = i + 1;
+        }
+        int fd = open(absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd < 0 || components.empty()) {
+            if(fd >= 0) close(fd);
+            return true;
+        }
+        std::string path = absolute ? "/" : "";
+        size_t first = found.at.size();
+        walk(fd, path, components, 0, want_dir, found);
+        std::string_view arena = found.arena;
+        std::sort(found.at.begin() + first, found.at.end(), [arena](auto &a, auto &b) {
+            return arena.substr(a.first, a.second) < arena.substr(b.first, b.second);
+        });
+        return true;
+    }
+
+    std::vector<std::string_view> words(const std::string &line, const std::vector<uint8_t> &quoting,
+                                        std::span<const std::string_view> tokens, int last_status, std::string &out) {
+        std::vector<std::pair<size_t, size_t>> at;   // into out; views are made once it stops growing
+        std::vector<std::string_view> ops;            // at entries {npos, i} stand for ops[i]
+        auto emit = [&](std::string_view text) {
+            at.emplace_back(out.size(), text.size());
+            out.append(text);
+            out += '\0';
+        };
+        std::vector<Word> expanded, fields;
+        for(auto t: tokens) {
+            bool in_line = t.data() >= line.data() && t.data() < line.data() + line.size();
+            if(!in_line) {
+                at.emplace_back(std::string_view::npos, ops.size());
+                ops.push_back(t);
+                continue;
+            }
+            size_t off = t.data() - line.data();
+            bool plain = true;
+            for(size_t i = 0; plain && i < t.size(); ++i) plain = !special(t[i], quoting[off + i]);
+            if(plain) {
+                emit(t);
+                continue;
+            }
+            Word w;
+            w.text.assign(t);
+            w.quoting.assign(reinterpret_cast<const char*>(quoting.data() + off), t.size());
+            expanded.clear();
+            braces(std::move(w), expanded);
+            for(auto &b: expanded) {
+                bool quoted = b.quoting.find_first_not_of(char(UNQUOTED)) != std::string::npos;
+                tilde(b);
+                fields.clear();
+                split(variables(b, last_status), quoted, fields);
+                for(auto &f: fields) {
+                    Found found;
+                    if(!glob(f, found)) emit(f.text);
+                    else if(found.at.empty()) emit(f.text);   // no match: the pattern stays as typed
+                    else for(auto [o, n]: found.at) emit(std::string_view(found.arena).substr(o, n));
+                }
+            }
+        }
+        std::vector<std::string_view> result;
+        result.reserve(at.size());
+        for(auto [o, n]: at) result.push_back(o == std::string_view::npos ? ops[n] : std::string_view(out.data() + o, n));
+        return result;
+    }
+}
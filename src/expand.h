@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <bitset>
+#include <cstdint>
+
+// Word expansion between tokenizing and parse_input: braces, `~` / `~user`,
+// `$VAR` / `${VAR}` / `$?` / `$$`, field splitting of unquoted expansions,
+// then pathname globbing. The tokenizer records how every byte it kept was
+// quoted, which is all this needs to tell `*` from `'*'`.
+namespace Expand {
+    // Per output byte of getCommandArgs.
+    enum Quoting : uint8_t {
+        UNQUOTED,
+        DOUBLE_QUOTED,   // `$` still expands, nothing else does
+        LITERAL,         // single-quoted or backslash-escaped
+        SPLIT,           // internal: blank produced by an unquoted expansion
+    };
+
+    // One path component of a glob, compiled once and matched against every
+    // directory entry: literal runs, `?`, `*` and `[...]` sets.
+    class Pattern {
+    public:
+        Pattern(std::string_view text, std::string_view quoting);
+        bool match(std::string_view name) const;
+        bool magic() const { return is_magic; }
+        // Dot files only match a pattern that starts with a literal '.'.
+        bool dotOk() const { return dot_ok; }
+        const std::string &literal() const { return lits; }
+    private:
+        enum Kind : uint8_t { LIT, ONE, STAR, SET };
+        struct Op {
+            Kind kind;
+            uint32_t off, len;   // LIT: into lits; SET: index into sets
+        };
+        std::vector<Op> ops;
+        std::string lits;
+        std::vector<std::bitset<256>> sets;
+        bool is_magic = false, dot_ok = false;
+    };
+
+    // True if any token has something to expand. Tokens that don't point into
+    // `line` (the tokenizer's operator literals) never do.
+    bool needed(const std::string &line, const std::vector<uint8_t> &quoting, std::span<const std::string_view> tokens);
+
+    // `$` substitutions only, as inside double quotes: here-doc bodies.
+    std::string variables(std::string_view text, int last_status);
+
+    // Expand `tokens` into NUL-terminated words stored in `out`. Operator
+    // tokens (not in `line`) come back as they were, identity included.
+    std::vector<std::string_view> words(const std::string &line, const std::vector<uint8_t> &quoting,
+                                        std::span<const std::string_view> tokens, int last_status, std::string &out);
+}
@@ -0,0 +1,58 @@
+#include "fd_buf.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+static void write_fully(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return;   // nothing sensible to do with the rest
+        data += n;
+        len -= n;
+    }
+}
+
+FdBuf::FdBuf(int fd, bool line) : fd(fd), line(line) {}
+
+FdBuf::~FdBuf() { drain(); }
+
+void FdBuf::drain() {
+    if(pptr() != pbase() && fd != -1) write_fully(fd, pbase(), pptr() - pbase());
+    setp(pbase(), epptr());
+}
+
+FdBuf::int_type FdBuf::overflow(int_type c) {
+    if(!block) {
+        block = std::make_unique<char[]>(BLOCK_SIZE);
+        setp(block.get(), block.get() + BLOCK_SIZE);
+    } else {
+        drain();
+    }
+    if(traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    if(line && c == '\n') drain();
+    return c;
+}
+
+std::streamsize FdBuf::xsputn(const char *s, std::streamsize n) {
+    if(size_t(n) > size_t(epptr() - pptr())) {
+        if(block) drain();
+        if(size_t(n) >= BLOCK_SIZE) {
+            // Too big to be worth copying.
+            if(fd != -1) write_fully(fd, s, n);
+            return n;
+        }
+        if(!block) overflow(traits_type::eof());
+    }
+    std::memcpy(pptr(), s, n);
+    pbump(int(n));
+    if(line && std::memchr(s, '\n', n)) drain();
+    return n;
+}
+
+int FdBuf::sync() {
+    drain();
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <streambuf>
+#include <memory>
+
+// Output stream buffer bound to a file descriptor, the write-side twin of
+// BlockReader. Text collects in one block and goes out when the block is
+// full or on flush; in line mode (stderr) also after each '\n'. A builtin
+// writing half a million `<<`s costs a few hundred writes, not one each.
+class FdBuf : public std::streambuf {
+public:
+    static const size_t BLOCK_SIZE = 1 << 16;
+
+    // fd == -1 discards everything (`>&-`). The fd is borrowed, not closed.
+    explicit FdBuf(int fd, bool line = false);
+    ~FdBuf() override;
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    void drain();
+
+    int fd;
+    bool line;
+    std::unique_ptr<char[]> block;   // allocated on first output
+};
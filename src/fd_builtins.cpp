@@ -0,0 +1,462 @@
+#include "fd_builtins.h"
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#if defined(__x86_64__)
+  #include <immintrin.h>
+#endif
+
+namespace FdBuiltins {
+    static const size_t BUF_SIZE = 1 << 18;
+    static const size_t CHUNK = 1 << 20;   // per splice/sendfile/copy_file_range call
+
+    bool is_fd_builtin(std::string_view name) {
+        return name == "cat" || name == "head" || name == "tee" || name == "wc";
+    }
+
+    static bool all_digits(std::string_view s) {
+        return !s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c) { return std::isdigit(c); });
+    }
+
+    bool supports(const std::vector<char*> &argv) {
+        std::string_view name = argv[0];
+        for(size_t i = 1; argv[i]; ++i) {
+            std::string_view arg = argv[i];
+            if(arg.size() < 2 || arg[0] != '-') continue;   // a file, or `-` for stdin
+            if(name == "head") {
+                if(all_digits(arg.substr(1))) continue;   // head -5
+                if((arg == "-n" || arg == "-c") && argv[i + 1] && all_digits(argv[i + 1])) {
+                    ++i;
+                    continue;
+                }
+                if((arg.starts_with("-n") || arg.starts_with("-c")) && all_digits(arg.substr(2))) continue;
+            } else if(name == "tee") {
+                if(arg == "-a") continue;
+            } else if(name == "wc") {
+                if(arg.find_first_not_of("lwc", 1) == std::string_view::npos) continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    static thread_local int cancel_fd = -1;
+    static thread_local bool cancelled = false;
+
+    // Wait until fd is ready, or fail with ECANCELED once the job is cancelled.
+    // Also checked before reads that never block (/dev/zero, regular files),
+    // so every chunk is a cancellation point.
+    static bool ready(int fd, short events) {
+        if(cancel_fd == -1) return true;
+        struct pollfd fds[2] = {{fd, events, 0}, {cancel_fd, POLLIN, 0}};
+        while(poll(fds, 2, -1) < 0) {
+            if(errno != EINTR) return true;
+        }
+        if(fds[1].revents & POLLIN) {
+            cancelled = true;
+            errno = ECANCELED;
+            return false;
+        }
+        return true;
+    }
+
+    static void report(int err_fd, const std::string &msg) {
+        std::string line = msg + "\n";
+        (void)!write(err_fd, line.data(), line.size());
+    }
+
+    static bool write_all(int fd, const char *data, size_t len) {
+        while(len > 0) {
+            if(!ready(fd, POLLOUT)) return false;
+            ssize_t n = write(fd, data, len);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+#if defined(__x86_64__)
+    // Compare 16/32 bytes at a time and keep per-byte hit counts in a vector
+    // register; fold them into 64-bit sums with SAD before a byte lane can wrap.
+    static size_t count_newlines_sse2(const char *data, size_t len, size_t &i) {
+        const __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+        __m128i total = zero;
+        while(i + 16 <= len) {
+            __m128i acc = zero;
+            size_t blocks = std::min<size_t>((len - i) / 16, 255);
+            for(size_t b = 0; b < blocks; ++b, i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+            }
+            total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+        }
+        return _mm_cvtsi128_si64(total) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+    }
+
+    __attribute__((target("avx2")))
+    static size_t count_newlines_avx2(const char *data, size_t len, size_t &i) {
+        const __m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+        __m256i total = zero;
+        while(i + 32 <= len) {
+            __m256i acc = zero;
+            size_t blocks = std::min<size_t>((len - i) / 32, 255);
+            for(size_t b = 0; b < blocks; ++b, i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+            }
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+        }
+        return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+               _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+    }
+#endif
+
+    size_t count_newlines(const char *data, size_t len) {
+        size_t count = 0, i = 0;
+    #if defined(__x86_64__)
+        static const bool has_avx2 = __builtin_cpu_supports("avx2");
+        count = has_avx2 ? count_newlines_avx2(data, len, i) : count_newlines_sse2(data, len, i);
+    #endif
+        for(; i < len; ++i) count += (data[i] == '\n');
+        return count;
+    }
+
+    // Plain read/write copy of up to `limit` bytes; the fallback for every fast path.
+    static bool copy_rw(int in, int out, unsigned long long &limit) {
+        std::string buf(BUF_SIZE, '\0');
+        while(limit > 0) {
+            if(!ready(in, POLLIN)) return false;
+            ssize_t n = read(in, buf.data(), std::min<unsigned long long>(BUF_SIZE, limit));
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0) return false;
+            if(n == 0) break;
+            if(!write_all(out, buf.data(), n)) return false;
+            limit -= n;
+        }
+        return true;
+    }
+
+    // Move up to `limit` bytes from in to out without a user-space copy when possible:
+    // splice if either side is a pipe, copy_file_range between regular files,
+    // sendfile from a regular file to anything else. Falls back to read/write.
+    static bool copy_fd(int in, int out, unsigned long long limit = ULLONG_MAX) {
+        struct stat in_st, out_st;
+        if(fstat(in, &in_st) != 0 || fstat(out, &out_st) != 0) return copy_rw(in, out, limit);
+        bool in_pipe = S_ISFIFO(in_st.st_mode), out_pipe = S_ISFIFO(out_st.st_mode);
+        bool in_reg = S_ISREG(in_st.st_mode), out_reg = S_ISREG(out_st.st_mode);
+        // O_APPEND targets reject splice/copy_file_range.
+        bool out_append = fcntl(out, F_GETFL) & O_APPEND;
+
+        enum { SPLICE, COPY_RANGE, SENDFILE, RW } mode = RW;
+        if((in_pipe || out_pipe) && !out_append) mode = SPLICE;
+        else if(in_reg && out_reg && !out_append) mode = COPY_RANGE;
+        else if(in_reg) mode = SENDFILE;
+
+        bool first = true;
+        while(limit > 0 && mode != RW) {
+            size_t want = std::min<unsigned long long>(CHUNK, limit);
+            if(!ready(in, POLLIN)) return false;
+            ssize_t n;
+            if(mode == SPLICE) n = splice(in, nullptr, out, nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+            else if(mode == COPY_RANGE) n = copy_file_range(in, nullptr, out, nullptr, want, 0);
+            else n = sendfile(out, in, nullptr, want);
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0) {
+                // Unsupported for this fd pair: nothing moved yet, so fall back cleanly.
+                if(first && (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP)) {
+                    mode = RW;
+                    break;
+                }
+                return false;
+            }
+            if(n == 0) return true;
+            limit -= n;
+            first = false;
+        }
+        return mode == RW ? copy_rw(in, out, limit) : true;
+    }
+
+    static int open_input(const char *name, int in_fd, int err_fd, const char *prog) {
+        if(std::strcmp(name, "-") == 0) return in_fd;
+        int fd = open(name, O_RDONLY | O_CLOEXEC);
+        if(fd == -1) report(err_fd, std::string(prog) + ": " + name + ": " + std::strerror(errno));
+        return fd;
+    }
+
+    static int run_cat(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd) {
+        int status = 0;
+        std::vector<const char*> files;
+        for(size_t i = 1; argv[i]; ++i) files.push_back(argv[i]);
+        if(files.empty()) files.push_back("-");
+        for(const char *name: files) {
+            int fd = open_input(name, in_fd, err_fd, "cat");
+            if(fd == -1) { status = 1; continue; }
+            if(!copy_fd(fd, out_fd)) {
+                if(errno == EPIPE || errno == ECANCELED) { if(fd != in_fd) close(fd); return 1; }
+                report(err_fd, std::string("cat: ") + name + ": " + std::strerror(errno));
+                status = 1;
+            }
+            if(fd != in_fd) close(fd);
+        }
+        return status;
+    }
+
+    static bool parse_count(const char *s, unsigned long long &out) {
+        char *end;
+        errno = 0;
+        out = std::strtoull(s, &end, 10);
+        return errno == 0 && *s && *end == '\0';
+    }
+
+    // First `lines` lines of fd. Finds line ends with memchr (SIMD in glibc).
+    static bool head_lines(int fd, int out_fd, unsigned long long lines) {
+        std::string buf(BUF_SIZE, '\0');
+        while(lines > 0) {
+            if(!ready(fd, POLLIN)) return false;
+            ssize_t n = read(fd, buf.data(), BUF_SIZE);
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0) return false;
+            if(n == 0) break;
+            const char *p = buf.data(), *end = buf.data() + n;
+            while(lines > 0 && p < end) {
+                const void *nl = std::memchr(p, '\n', end - p);
+                if(!nl) { p = end; break; }
+                p = static_cast<const char*>(nl) + 1;
+                lines--;
+            }
+            if(!write_all(out_fd, buf.data(), p - buf.data())) return false;
+        }
+        return true;
+    }
+
+    static int run_head(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd) {
+        bool bytes = false;
+        unsigned long long count = 10;
+        std::vector<const char*> files;
+        for(size_t i = 1; argv[i]; ++i) {
+            std::string arg = argv[i];
+            if((arg == "-n" || arg == "-c") && argv[i + 1]) {
+                bytes = (arg == "-c");
+                if(!parse_count(argv[++i], count)) {
+                    report(err_fd, std::string("head: invalid number: '") + argv[i] + "'");
+                    return 1;
+                }
+            } else if(arg.size() > 2 && (arg.rfind("-n", 0) == 0 || arg.rfind("-c", 0) == 0)) {
+                bytes = (arg[1] == 'c');
+                if(!parse_count(arg.c_str() + 2, count)) {
+                    report(err_fd, "head: invalid number: '" + arg.substr(2) + "'");
+                    return 1;
+                }
+            } else if(arg.size() > 1 && arg[0] == '-' && std::isdigit((unsigned char)arg[1])) {
+                parse_count(arg.c_str() + 1, count);  // head -5
+            } else {
+                files.push_back(argv[i]);
+            }
+        }
+        if(files.empty()) files.push_back("-");
+        int status = 0;
+        for(size_t f = 0; f < files.size(); ++f) {
+            int fd = open_input(files[f], in_fd, err_fd, "head");
+            if(fd == -1) { status = 1; continue; }
+            if(files.size() > 1) {
+                std::string title = std::string(f ? "\n" : "") + "==> " + files[f] + " <==\n";
+                write_all(out_fd, title.data(), title.size());
+            }
+            bool ok = bytes ? copy_fd(fd, out_fd, count) : head_lines(fd, out_fd, count);
+            if(!ok && errno != EPIPE && errno != ECANCELED) {
+                report(err_fd, std::string("head: ") + files[f] + ": " + std::strerror(errno));
+                status = 1;
+            }
+            if(fd != in_fd) close(fd);
+        }
+        return status;
+    }
+
+    static int run_tee(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd) {
+        bool append = false;
+        std::vector<int> fds;
+        int status = 0;
+        for(size_t i = 1; argv[i]; ++i) {
+            if(std::strcmp(argv[i], "-a") == 0) { append = true; continue; }
+            int fd = open(argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+            if(fd == -1) {
+                report(err_fd, std::string("tee: ") + argv[i] + ": " + std::strerror(errno));
+                status = 1;
+            } else {
+                fds.push_back(fd);
+            }
+        }
+
+        struct stat in_st, out_st;
+        bool pipes = fstat(in_fd, &in_st) == 0 && fstat(out_fd, &out_st) == 0 &&
+                     S_ISFIFO(in_st.st_mode) && S_ISFIFO(out_st.st_mode);
+        bool done = false;
+        if(fds.empty()) {
+            copy_fd(in_fd, out_fd);
+            done = true;
+        } else if(pipes && fds.size() == 1 && !append) {
+            // pipe -> pipe: tee(2) duplicates into stdout without consuming, then
+            // splice moves the same bytes into the file. No user-space copies.
+            bool first = true;
+            done = true;
+            while(ready(in_fd, POLLIN)) {
+                ssize_t n = tee(in_fd, out_fd, CHUNK, 0);
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0) {
+                    // Nothing consumed yet, so the buffered loop can take over.
+                    if(first && errno == EINVAL) done = false;
+                    break;
+                }
+                if(n == 0) break;
+                first = false;
+                while(n > 0) {
+                    ssize_t m = splice(in_fd, nullptr, fds[0], nullptr, n, SPLICE_F_MOVE);
+                    if(m < 0 && errno == EINTR) continue;
+                    if(m <= 0) break;
+                    n -= m;
+                }
+                if(n > 0) {
+                    status = 1;
+                    break;
+                }
+            }
+        }
+        if(!done) {
+            std::string buf(BUF_SIZE, '\0');
+            bool out_ok = true;
+            while(ready(in_fd, POLLIN)) {
+                ssize_t n = read(in_fd, buf.data(), BUF_SIZE);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) break;
+                // Keep writing the files even after stdout's reader has gone away.
+                if(out_ok) out_ok = write_all(out_fd, buf.data(), n);
+                for(int fd: fds) write_all(fd, buf.data(), n);
+            }
+        }
+        for(int fd: fds) close(fd);
+        return status;
+    }
+
+    static int run_wc(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd) {
+        bool lines = false, words = false, bytes = false;
+        std::vector<const char*> files;
+        for(size_t i = 1; argv[i]; ++i) {
+            const char *arg = argv[i];
+            if(arg[0] == '-' && arg[1]) {
+                for(const char *c = arg + 1; *c; ++c) {
+                    if(*c == 'l') lines = true;
+                    else if(*c == 'w') words = true;
+                    else if(*c == 'c') bytes = true;
+                    else {
+                        report(err_fd, std::string("wc: invalid option -- '") + *c + "'");
+                        return 1;
+                    }
+                }
+            } else {
+                files.push_back(arg);
+            }
+        }
+        if(!lines && !words && !bytes) lines = words = bytes = true;
+        bool named = !files.empty();
+        if(files.empty()) files.push_back("-");
+
+        struct Counts { unsigned long long l = 0, w = 0, c = 0; };
+        std::vector<Counts> results;
+        std::vector<std::string> names;
+        Counts total;
+        bool all_regular = true;
+        int status = 0;
+        std::string buf(BUF_SIZE, '\0');
+        for(const char *name: files) {
+            int fd = open_input(name, in_fd, err_fd, "wc");
+            if(fd == -1) { status = 1; continue; }
+            Counts c;
+            struct stat st;
+            if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) all_regular = false;
+            if(bytes && !lines && !words && all_regular && S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) == 0) {
+                c.c = st.st_size;   // -c on a regular file: no need to read it
+            } else {
+                bool in_word = false;
+                while(ready(fd, POLLIN)) {
+                    ssize_t n = read(fd, buf.data(), BUF_SIZE);
+                    if(n < 0 && errno == EINTR) continue;
+                    if(n <= 0) break;
+                    c.c += n;
+                    if(lines) c.l += count_newlines(buf.data(), n);
+                    if(words) {
+                        for(ssize_t i = 0; i < n; ++i) {
+                            bool space = std::isspace((unsigned char)buf[i]);
+                            if(!space && !in_word) c.w++;
+                            in_word = !space;
+                        }
+                    }
+                }
+            }
+            if(fd != in_fd) close(fd);
+            total.l += c.l; total.w += c.w; total.c += c.c;
+            results.push_back(c);
+            names.push_back(named ? name : "");
+        }
+        if(cancelled) return 1;   // no partial counts
+        if(results.size() > 1) {
+            results.push_back(total);
+            names.push_back("total");
+        }
+
+        // Same column widths as coreutils: none for a single number, otherwise wide
+        // enough for the total byte count (at least 7 when an input wasn't a regular file).
+        int columns = lines + words + bytes;
+        size_t width = 1;
+        if(columns > 1 || results.size() > 1) {
+            unsigned long long widest = std::max({total.l, total.w, total.c});
+            width = std::to_string(widest).size();
+            if(!all_regular) width = std::max<size_t>(width, 7);
+        }
+        std::string out;
+        for(size_t r = 0; r < results.size(); ++r) {
+            std::string row;
+            auto field = [&](unsigned long long v) {
+                std::string s = std::to_string(v);
+                if(!row.empty()) row += ' ';
+                if(s.size() < width) row.append(width - s.size(), ' ');
+                row += s;
+            };
+            if(lines) field(results[r].l);
+            if(words) field(results[r].w);
+            if(bytes) field(results[r].c);
+            if(!names[r].empty()) row += " " + names[r];
+            out += row + "\n";
+        }
+        write_all(out_fd, out.data(), out.size());
+        return status;
+    }
+
+    static int dispatch(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd) {
+        std::string_view name = argv[0];
+        if(name == "cat") return run_cat(argv, in_fd, out_fd, err_fd);
+        if(name == "head") return run_head(argv, in_fd, out_fd, err_fd);
+        if(name == "tee") return run_tee(argv, in_fd, out_fd, err_fd);
+        if(name == "wc") return run_wc(argv, in_fd, out_fd, err_fd);
+        return 127;
+    }
+
+    int run(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd, int cancel) {
+        cancel_fd = cancel;
+        cancelled = false;
+        int status = dispatch(argv, in_fd, out_fd, err_fd);
+        cancel_fd = -1;
+        return cancelled ? 128 + SIGINT : status;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string_view>
+#include <vector>
+
+// Data-moving builtins (cat, head, tee, wc) that work directly on file
+// descriptors. They move bytes with splice/copy_file_range/sendfile where
+// the kernel allows it and count newlines with SIMD, so they can run as a
+// pipeline stage on a thread of their own without touching std::cout.
+namespace FdBuiltins {
+    bool is_fd_builtin(std::string_view name);
+
+    // Whether the builtin implements every option in argv (cat none, head
+    // -n/-c/-NUM, tee -a, wc -l/-w/-c). For anything else, such as `cat -n`
+    // or `wc -m`, the shell runs the command from PATH instead.
+    bool supports(const std::vector<char*> &argv);
+
+    // argv is NUL-terminated. The fds are borrowed, not closed. Returns an exit
+    // status. Once `cancel_fd` (an eventfd) becomes readable the builtin stops
+    // at its next read or write and returns 130, as if killed by SIGINT.
+    int run(const std::vector<char*> &argv, int in_fd, int out_fd, int err_fd, int cancel_fd = -1);
+
+    // Number of '\n' bytes in [data, data + len).
+    size_t count_newlines(const char *data, size_t len);
+}
@@ -0,0 +1,425 @@
+#include "history.h"
+#include "fd_builtins.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unordered_set>
+
+namespace HISTORY {
+    static void cannot_open(const std::string &file) {
+        std::cerr << "history: cannot open file '" << file << "'" << std::endl;
+    }
+
+    // Start of the newest `want` non-empty lines of [base, end), found from the
+    // back with memrchr so the older part of a long file is never read.
+    static const char *tail_start(const char *base, const char *end, size_t want) {
+        if(want == 0) return end;
+        const char *stop = end;
+        size_t lines = 0;
+        while(true) {
+            const char *nl = static_cast<const char*>(memrchr(base, '\n', stop - base));
+            const char *start = nl ? nl + 1 : base;
+            if(stop > start && ++lines == want) return start;
+            if(!nl) return base;
+            stop = nl;
+        }
+    }
+
+    // The newest `want` non-empty lines (all for a negative `want`) of the file
+    // open at `fd`, `len` bytes long. pread from the back, reading four times
+    // as much each round until enough lines are in. A file that shrinks
+    // meanwhile just reads short.
+    static std::string read_tail(int fd, size_t len, long want) {
+        size_t size = want < 0 ? len : std::min<size_t>(len, 1 << 16);
+        while(true) {
+            std::string data(size, '\0');
+            size_t got = 0;
+            while(got < size) {
+                ssize_t n = pread(fd, data.data() + got, size - got, len - size + got);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) break;
+                got += n;
+            }
+            data.resize(got);
+            const char *base = data.data(), *start = want < 0 ? base : tail_start(base, base + got, want);
+            if(start != base || got < size || size == len) {
+                data.erase(0, start - base);
+                return data;
+            }
+            size = std::min(len, size * 4);
+        }
+    }
+
+    static bool write_all(int fd, const std::string &data) {
+        size_t done = 0;
+        while(done < data.size()) {
+            ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // Write-then-rename: a reader (or our own mapping of the old file) never
+    // sees it truncated.
+    static bool replace_file(const std::string &file, const std::string &data) {
+        std::string tmp = file + ".tmp." + std::to_string(getpid());
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if(fd == -1) return false;
+        bool ok = write_all(fd, data);
+        close(fd);
+        if(!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Open and flock `file`. Compaction renames a new file over the old one, so
+    // after waiting for the lock make sure it is still the file at that path.
+    static int lock_file(const std::string &file, int flags, int operation, struct stat &st) {
+        while(true) {
+            int fd = open(file.c_str(), flags | O_CLOEXEC, 0600);
+            if(fd == -1) return -1;
+            int r;
+            while((r = flock(fd, operation)) < 0 && errno == EINTR) {}
+            struct stat now;
+            if(r == 0 && fstat(fd, &st) == 0 && stat(file.c_str(), &now) == 0 &&
+               now.st_dev == st.st_dev && now.st_ino == st.st_ino) return fd;
+            close(fd);
+            if(r != 0) return -1;
+        }
+    }
+
+    // Unlock explicitly: a mapping of the file keeps the open file (and with it
+    // the flock) alive after close().
+    static void unlock_close(int fd) {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    // Whether the file open at `fd` (`len` bytes) has more than `max` non-empty
+    // lines. Reads only its last `max` + 1 lines, not the whole file.
+    static bool over_limit(int fd, size_t len, long max) {
+        if(max < 0) return false;
+        std::string tail = read_tail(fd, len, max + 1);
+        long lines = 0;
+        for(size_t p = 0; p < tail.size(); ) {
+            size_t e = tail.find('\n', p);
+            if(e == std::string::npos) e = tail.size();
+            if(e > p) lines++;
+            p = e + 1;
+        }
+        return lines > max;
+    }
+
+    static long parse_limit(const char *value, long fallback) {
+        if(!value || !*value) return fallback;
+        char *end;
+        long n = std::strtol(value, &end, 10);
+        if(*end) return fallback;
+        return n < 0 ? -1 : n;
+    }
+
+    // Below this many entries the search index is built when first needed (well
+    // under a millisecond per 1000 entries); above it, in the background at startup.
+    static const size_t PREBUILD_ENTRIES = 20000;
+
+    Store::~Store() {
+        cancel_build = true;
+        wait_index();
+        for(auto &slot: ring) release(slot);
+    }
+
+    void Store::set_limits(const char *histsize, const char *histfilesize) {
+        limit = parse_limit(histsize, 500);
+        file_limit = parse_limit(histfilesize, limit);
+    }
+
+    void Store::release(Slot &slot) {
+        if(slot.owned) delete[] slot.data;
+        slot = Slot();
+    }
+
+    // The builder thread only reads the ring; everything that changes it waits first.
+    void Store::wait_index() {
+        if(index_builder.joinable()) index_builder.join();
+    }
+
+    void Store::build_index() {
+        auto built = std::make_unique<SearchIndex>(size());
+        for(size_t i = 0; i < size(); ++i) {
+            if(cancel_build.load(std::memory_order_relaxed)) return;
+            built->add((*this)[i], dropped + i);
+        }
+        index = std::move(built);
+    }
+
+    void Store::push(const char *data, size_t len, bool owned) {
+        wait_index();
+        Slot *slot;
+        if(limit < 0 || ring.size() < static_cast<size_t>(limit)) {
+            slot = &ring.emplace_back();
+        } else {
+            // Full: the oldest slot is reused for the newest entry.
+            slot = &ring[head];
+            if(index) index->remove(std::string_view(slot->data, slot->len), dropped);
+            release(*slot);
+            head = (head + 1) % ring.size();
+            dropped++;
+        }
+        slot->data = data;
+        slot->len = len;
+        slot->owned = owned;
+        slot->fresh = false;
+        if(index) index->add(std::string_view(data, len), dropped + ring.size() - 1);
+    }
+
+    std::string_view Store::operator[](size_t i) const {
+        const Slot &slot = ring[(head + i) % ring.size()];
+        return std::string_view(slot.data, slot.len);
+    }
+
+    void Store::add(std::string_view line) {
+        if(limit == 0 || line.find_first_not_of(" \t\r\n") == std::string_view::npos) return;
+        char *copy = new char[line.size()];
+        std::memcpy(copy, line.data(), line.size());
+        push(copy, line.size(), true);
+        ring[(head + size() - 1) % ring.size()].fresh = true;
+    }
+
+    // Add the newest entries of the file open at `fd` (`len` bytes) to the list.
+    // They point into a block that lives as long as the store, or are copied
+    // out one by one when `copy` is set. Returns the number added.
+    size_t Store::index_fd(int fd, size_t len, bool copy) {
+        if(len == 0 || limit == 0) return 0;
+        auto block = std::make_unique<std::string>(read_tail(fd, len, limit));
+        const char *cut = block->data(), *end = cut + block->size();
+        size_t lines = FdBuiltins::count_newlines(cut, end - cut) + 1;
+        size_t room = ring.size() + lines;
+        ring.reserve(limit < 0 ? room : std::min<size_t>(room, limit));
+
+        size_t added = 0;
+        for(const char *p = cut; p < end; ) {
+            const char *nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            const char *e = nl ? nl : end;
+            if(e > p) {
+                if(copy) {
+                    char *buf = new char[e - p];
+                    std::memcpy(buf, p, e - p);
+                    push(buf, e - p, true);
+                } else {
+                    push(p, e - p, false);
+                }
+                added++;
+            }
+            p = e + 1;
+        }
+        if(!copy) blocks.push_back(std::move(block));
+        return added;
+    }
+
+    std::vector<std::string> Store::search(std::string_view query, size_t limit) {
+        wait_index();
+        if(!index) build_index();
+        return index->search(query, limit, *this, dropped);
+    }
+
+    void Store::load(const std::string &file) {
+        struct stat st;
+        int fd = lock_file(file, O_RDONLY, LOCK_SH, st);
+        if(fd == -1) return;
+        index_fd(fd, st.st_size, false);
+        files[file] = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_size), {}};
+        unlock_close(fd);
+        if(size() >= PREBUILD_ENTRIES) index_builder = std::thread(&Store::build_index, this);
+    }
+
+    bool Store::read(const std::string &file) {
+        // Copied line by line, so entries pushed out of the ring free their memory.
+        struct stat st;
+        int fd = lock_file(file, O_RDONLY, LOCK_SH, st);
+        size_t added = (fd == -1) ? SIZE_MAX : index_fd(fd, st.st_size, true);
+        if(fd != -1) unlock_close(fd);
+        if(added == SIZE_MAX) {
+            cannot_open(file);
+            return false;
+        }
+        return true;
+    }
+
+    bool Store::read_new(const std::string &file) {
+        struct stat st;
+        int fd = lock_file(file, O_RDONLY, LOCK_SH, st);
+        if(fd == -1) {
+            cannot_open(file);
+            return false;
+        }
+        FileState &state = files[file];
+        uint64_t size = st.st_size;
+        bool same = state.dev == static_cast<uint64_t>(st.st_dev) && state.ino == static_cast<uint64_t>(st.st_ino);
+        if(!same && state.ino != 0) {
+            // Rewritten (compacted) since we last looked; what it holds is old news.
+            state = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), size, {}};
+            unlock_close(fd);
+            return true;
+        }
+        if(!same) state = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), 0, {}};
+
+        // Only what was appended since: cost follows the new lines, not the file.
+        std::string data(size > state.offset ? size - state.offset : 0, '\0');
+        size_t got = 0;
+        while(got < data.size()) {
+            ssize_t n = pread(fd, data.data() + got, data.size() - got, state.offset + got);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            got += n;
+        }
+        unlock_close(fd);
+        data.resize(got);
+        size_t complete = data.rfind('\n') + 1;   // 0 if there is no full line yet
+
+        for(size_t p = 0; p < complete; ) {
+            size_t e = data.find('\n', p);
+            uint64_t at = state.offset + p;
+            // Skip our own appends; those lines are in the list already.
+            bool own = std::any_of(state.own.begin(), state.own.end(), [&](auto &r) { return at >= r.first && at < r.second; });
+            if(e > p && !own) {
+                char *buf = new char[e - p];
+                std::memcpy(buf, data.data() + p, e - p);
+                push(buf, e - p, true);
+            }
+            p = e + 1;
+        }
+        state.offset += complete;
+        state.own.erase(std::remove_if(state.own.begin(), state.own.end(), [&](auto &r) { return r.second <= state.offset; }), state.own.end());
+        return true;
+    }
+
+    bool Store::write(const std::string &file) {
+        std::string data;
+        for(size_t i = 0; i < size(); ++i) {
+            data += (*this)[i];
+            data += '\n';
+        }
+        // Hold the old file's lock so no append lands in it during the swap.
+        struct stat st;
+        int fd = lock_file(file, O_WRONLY | O_CREAT, LOCK_EX, st);
+        bool ok = fd != -1 && replace_file(file, data);
+        if(fd != -1) unlock_close(fd);
+        if(!ok) {
+            cannot_open(file);
+            return false;
+        }
+        if(stat(file.c_str(), &st) == 0) files[file] = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), data.size(), {}};
+        for(auto &slot: ring) slot.fresh = false;
+        fresh_from = dropped + size();
+        return true;
+    }
+
+    bool Store::append(const std::string &file) {
+        std::string data;
+        for(size_t i = std::max(fresh_from, dropped) - dropped; i < size(); ++i) {
+            Slot &slot = ring[(head + i) % ring.size()];
+            if(!slot.fresh) continue;
+            data.append(slot.data, slot.len);
+            data += '\n';
+        }
+        if(data.empty()) return true;
+
+        struct stat st;
+        int fd = lock_file(file, O_RDWR | O_CREAT | O_APPEND, LOCK_EX, st);
+        if(fd == -1) {
+            cannot_open(file);
+            return false;
+        }
+        // One write under the lock: lines from shells exiting together never interleave.
+        if(!write_all(fd, data)) {
+            unlock_close(fd);
+            return false;
+        }
+        for(size_t i = std::max(fresh_from, dropped) - dropped; i < size(); ++i) ring[(head + i) % ring.size()].fresh = false;
+        fresh_from = dropped + size();
+
+        uint64_t before = st.st_size, after = before + data.size();
+        if(over_limit(fd, after, file_limit)) {
+            // Past HISTFILESIZE: trim it now, still under the lock, so the file
+            // doesn't grow without bound between manual compactions.
+            st.st_size = after;
+            return compact_locked(file, fd, st);
+        }
+        unlock_close(fd);
+
+        FileState &state = files[file];
+        if(state.dev != static_cast<uint64_t>(st.st_dev) || state.ino != static_cast<uint64_t>(st.st_ino)) {
+            // Not read before (or replaced): history -n takes everything but our lines.
+            state = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), 0, {}};
+        }
+        if(before == state.offset) state.offset = after;
+        else state.own.emplace_back(before, after);
+        return true;
+    }
+
+    bool Store::compact(const std::string &file) {
+        struct stat st;
+        int fd = lock_file(file, O_RDONLY, LOCK_EX, st);
+        if(fd == -1) {
+            cannot_open(file);
+            return false;
+        }
+        return compact_locked(file, fd, st);
+    }
+
+    // Rewrite `file`, open and exclusively locked at `fd`, keeping the latest
+    // copy of each line up to HISTFILESIZE. Closes `fd`.
+    bool Store::compact_locked(const std::string &file, int fd, struct stat &st) {
+        std::string data;
+        if(st.st_size > 0) {
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(addr == MAP_FAILED) {
+                unlock_close(fd);
+                return false;
+            }
+            // Newest first, keeping the latest copy of each line, up to HISTFILESIZE.
+            const char *base = static_cast<const char*>(addr), *stop = base + st.st_size;
+            std::unordered_set<std::string_view> seen;
+            std::vector<std::string_view> keep;
+            size_t max_lines = file_limit < 0 ? SIZE_MAX : file_limit;
+            size_t lines = std::min(max_lines, FdBuiltins::count_newlines(base, st.st_size) + 1);
+            seen.reserve(lines);
+            keep.reserve(lines);
+            while(keep.size() < max_lines) {
+                const char *nl = static_cast<const char*>(memrchr(base, '\n', stop - base));
+                const char *start = nl ? nl + 1 : base;
+                std::string_view line(start, stop - start);
+                if(!line.empty() && seen.insert(line).second) keep.push_back(line);
+                if(!nl) break;
+                stop = nl;
+            }
+            data.reserve(st.st_size);
+            for(size_t i = keep.size(); i-- > 0; ) {
+                data += keep[i];
+                data += '\n';
+            }
+            munmap(addr, st.st_size);
+        }
+        bool ok = replace_file(file, data);
+        unlock_close(fd);
+        if(!ok) {
+            cannot_open(file);
+            return false;
+        }
+        // Our view of the file starts over at its new end.
+        if(stat(file.c_str(), &st) == 0) files[file] = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), data.size(), {}};
+        return true;
+    }
+}
@@ -1,54 +1,97 @@
 #pragma once 
-#include "command.h"
 #include <string>
-#include <sstream>
-#include <fstream>
-#include <iostream>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <sys/stat.h>
+#include "history_search.h"
 
 namespace HISTORY {
-    void read_history(const std::string &file_loc, std::vector<Command> &history) {
-      std::ifstream fd(file_loc);
-      if(fd.is_open()) {
-        std::string cmds;
-        while (std::getline(fd, cmds)) {
-          if(cmds.empty()) continue;  // Skip empty lines
-          Command cmd;
-          std::stringstream ss(cmds);
-          std::string arg;
-          while(ss >> arg) {
-            cmd.args.push_back(arg);
-          }
-          history.push_back(cmd);
-          history.back().get_argv();
-        }
-        fd.close();
-      } else {
-        std::cerr << "history: cannot open file '" << file_loc << "'" << std::endl;
-      }
-    }
-
-    void write_history(const std::string &file_loc, std::vector<Command> &history) {
-      std::ofstream fd(file_loc);
-      if(fd.is_open()) {
-        for(auto &cmd: history){
-          for(size_t i = 0; i < cmd.args.size() ; ++i) fd << cmd.args[i] << ((i != cmd.args.size()-1)?" ":"\n");
-        }
-        fd.close();
-      } else {
-        std::cerr << "history: cannot open file '" << file_loc << "'" << std::endl;
-      }
-    }
-
-    void append_history(const std::string &file_loc, int append_pointer, std::vector<Command> &history){
-      std::ofstream fd(file_loc, std::ios::app);
-      if(fd.is_open()) {
-        for(append_pointer; append_pointer < history.size(); ++append_pointer){
-          for(size_t i = 0; i < history[append_pointer].args.size() ; ++i) fd << history[append_pointer].args[i] << ((i != history[append_pointer].args.size()-1)?" ":"\n");
-        }
-        // std::cout<<append_pointer << std::endl;
-        fd.close();
-      } else {
-        std::cerr << "history: cannot open file '" << file_loc << "'" << std::endl;
-      }
-    }
-}
\ No newline at end of file
+    // Command history: a ring of at most HISTSIZE lines. Entries loaded from
+    // HISTFILE point into one block holding its newest HISTSIZE lines, read
+    // from the back so the older part of the file never is; lines typed in
+    // this session are owned copies. Nothing stays mapped, so another process
+    // truncating the file can't fault the shell.
+    //
+    // HISTFILE can be shared by many shells. Writers only ever append, in one
+    // write under flock; each shell remembers how far into the file it has read
+    // and which byte ranges it appended itself, so `history -n` reads just the
+    // lines other sessions added since. Deduplicating and trimming to
+    // HISTFILESIZE is a compaction pass that swaps in a new file; an append
+    // that takes the file past HISTFILESIZE runs it under the same lock.
+    class Store {
+    public:
+        Store() = default;
+        Store(const Store&) = delete;
+        Store& operator=(const Store&) = delete;
+        ~Store();
+
+        // Limits from HISTSIZE / HISTFILESIZE, as in bash: the list keeps 500
+        // entries by default, the file as many as the list,
+        // and a negative value means unlimited.
+        void set_limits(const char *histsize, const char *histfilesize);
+
+        // Startup: index the newest entries of `file` in place. A missing file is fine.
+        void load(const std::string &file);
+        // history -r: add the entries of `file` to the list.
+        bool read(const std::string &file);
+        // history -w: replace `file` with the list.
+        bool write(const std::string &file);
+        // history -a, and exit: append the entries typed since the last append,
+        // compacting the file if that takes it past HISTFILESIZE.
+        bool append(const std::string &file);
+        // history -n: add the lines other sessions appended to `file` since we last looked.
+        bool read_new(const std::string &file);
+        // history --compact: drop older duplicates, keep the newest HISTFILESIZE
+        // lines, and atomically replace `file` with the result.
+        bool compact(const std::string &file);
+
+        void add(std::string_view line);
+
+        size_t size() const { return ring.size(); }
+        // i = 0 is the oldest entry still in the list.
+        std::string_view operator[](size_t i) const;
+        // Number shown by `history` for entry i (keeps counting as old entries drop off).
+        size_t number(size_t i) const { return dropped + i + 1; }
+
+        // Ctrl-R: entries containing `query`, best first. The index is built on
+        // the first search and kept up to date from then on.
+        std::vector<std::string> search(std::string_view query, size_t limit);
+
+    private:
+        struct Slot {
+            const char *data = nullptr;   // into a loaded block, or a new[] buffer when owned
+            uint32_t len = 0;
+            bool owned = false;
+            bool fresh = false;           // typed here and not appended to a file yet
+        };
+        // What this shell knows about a history file it reads and appends to.
+        struct FileState {
+            uint64_t dev = 0, ino = 0;
+            uint64_t offset = 0;     // everything before this has been read
+            std::vector<std::pair<uint64_t, uint64_t>> own;   // our appends past offset
+        };
+
+        std::vector<Slot> ring;
+        size_t head = 0;        // slot of the oldest entry once the ring is full
+        size_t dropped = 0;     // entries evicted so far
+        size_t fresh_from = 0;  // no fresh entries are numbered below this
+        long limit = 500, file_limit = 500;
+        std::vector<std::unique_ptr<std::string>> blocks;   // file contents entries point into
+        std::map<std::string, FileState> files;
+        std::unique_ptr<SearchIndex> index;
+        std::thread index_builder;   // fills `index` for a large HISTFILE at startup
+        std::atomic<bool> cancel_build{false};
+
+        void wait_index();
+        void build_index();
+        void push(const char *data, size_t len, bool owned);
+        void release(Slot &slot);
+        size_t index_fd(int fd, size_t len, bool copy);
+        bool compact_locked(const std::string &file, int fd, struct stat &st);
+    };
+}
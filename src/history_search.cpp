@@ -0,0 +1,146 @@
+#include "history_search.h"
+#include "history.h"
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <cstring>
+
+namespace HISTORY {
+    static uint32_t bucket_of(const char *p, uint32_t bits) {
+        uint32_t trigram = (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+        return (trigram * 2654435761u) >> (32 - bits);
+    }
+
+    static uint32_t hash_text(std::string_view text) {
+        return std::hash<std::string_view>()(text);
+    }
+
+    SearchIndex::SearchIndex(size_t expected) : buckets(1u << BUCKET_BITS) {
+        size_t size = 64;
+        while(size < expected * 2) size *= 2;
+        uses.resize(size);
+    }
+
+    // Slot holding `text`, or the free slot where it would go.
+    size_t SearchIndex::find(std::string_view text, uint32_t hash) const {
+        size_t mask = uses.size() - 1;
+        for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+            const Use &u = uses[i];
+            if(!u.text || (u.hash == hash && u.len == text.size() && std::memcmp(u.text, text.data(), u.len) == 0)) return i;
+        }
+    }
+
+    void SearchIndex::grow() {
+        std::vector<Use> old(uses.size() * 2);
+        old.swap(uses);
+        for(auto &u: old) {
+            if(u.text) uses[find(std::string_view(u.text, u.len), u.hash)] = u;
+        }
+    }
+
+    void SearchIndex::add(std::string_view text, uint64_t seq) {
+        uint32_t hash = hash_text(text);
+        Use &u = uses[find(text, hash)];
+        if(!u.text) used++;
+        // Point at this occurrence, the newest one.
+        u.text = text.data();
+        u.len = text.size();
+        u.hash = hash;
+        u.count++;
+        u.last = seq;
+        max_count = std::max(max_count, u.count);
+        live++;
+        if(used * 2 > uses.size()) grow();
+
+        uint32_t block = seq / BLOCK;
+        for(size_t i = 0; i + 3 <= text.size(); ++i) {
+            std::vector<uint32_t> &list = buckets[bucket_of(text.data() + i, BUCKET_BITS)];
+            if(list.empty() || list.back() != block) list.push_back(block);
+        }
+    }
+
+    void SearchIndex::remove(std::string_view text, uint64_t seq) {
+        size_t mask = uses.size() - 1;
+        size_t i = find(text, hash_text(text));
+        if(uses[i].text && --uses[i].count == 0) {
+            // Backward-shift delete: pull later entries of the probe run into the hole.
+            used--;
+            for(size_t j = (i + 1) & mask; uses[j].text; j = (j + 1) & mask) {
+                size_t home = uses[j].hash & mask;
+                bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+                if(stays) continue;
+                uses[i] = uses[j];
+                i = j;
+            }
+            uses[i] = Use();
+        }
+        live--;
+        // Searches skip evicted blocks anyway; trim them once they are half the postings.
+        if(++stale > live) compact(seq + 1);
+    }
+
+    void SearchIndex::compact(uint64_t first) {
+        uint32_t block = first / BLOCK;
+        for(auto &list: buckets) {
+            list.erase(list.begin(), std::lower_bound(list.begin(), list.end(), block));
+        }
+        stale = 0;
+    }
+
+    std::vector<std::string> SearchIndex::search(std::string_view query, size_t limit, const Store &history, uint64_t first) const {
+        uint64_t now = first + history.size();
+        // Frecency: uses count logarithmically, and a line's weight halves once 128
+        // newer entries have been added since its last use (and keeps falling).
+        auto score = [](uint32_t count, uint64_t age) {
+            return (1 + std::log2((double)count)) / (1 + (double)age / 128);
+        };
+        double best_possible = 1 + std::log2((double)max_count);
+
+        using Hit = std::pair<double, uint64_t>;   // (score, number); the heap keeps the worst on top
+        std::priority_queue<Hit, std::vector<Hit>, std::greater<Hit>> top;
+        // Returns false once no entry this old or older can make the top `limit`.
+        auto visit = [&](uint64_t seq) {
+            uint64_t age = now - seq;
+            if(top.size() == limit && best_possible / (1 + (double)age / 128) < top.top().first) return false;
+            std::string_view text = history[seq - first];
+            if(text.find(query) == std::string_view::npos) return true;
+            const Use &u = uses[find(text, hash_text(text))];
+            if(!u.text || u.last != seq) return true;  // an older duplicate
+            double s = score(u.count, age);
+            if(top.size() < limit) top.emplace(s, seq);
+            else if(s > top.top().first) {
+                top.pop();
+                top.emplace(s, seq);
+            }
+            return true;
+        };
+
+        if(limit == 0 || query.empty()) return {};
+        if(query.size() < 3) {
+            // No trigram to narrow it down; short queries match often, so the walk ends early.
+            for(uint64_t seq = now; seq-- > first && visit(seq); ) {}
+        } else {
+            // Intersect the query's buckets, shortest list first.
+            std::vector<const std::vector<uint32_t>*> lists;
+            for(size_t i = 0; i + 3 <= query.size(); ++i) lists.push_back(&buckets[bucket_of(query.data() + i, BUCKET_BITS)]);
+            std::sort(lists.begin(), lists.end(), [](auto *a, auto *b) { return a->size() < b->size(); });
+            lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+            std::vector<uint32_t> blocks(std::lower_bound(lists[0]->begin(), lists[0]->end(), first / BLOCK), lists[0]->end());
+            std::vector<uint32_t> next;
+            for(size_t l = 1; l < lists.size() && !blocks.empty(); ++l) {
+                next.clear();
+                std::set_intersection(blocks.begin(), blocks.end(), lists[l]->begin(), lists[l]->end(), std::back_inserter(next));
+                blocks.swap(next);
+            }
+            bool more = true;
+            for(size_t b = blocks.size(); more && b-- > 0; ) {
+                uint64_t lo = std::max<uint64_t>((uint64_t)blocks[b] * BLOCK, first);
+                for(uint64_t seq = std::min<uint64_t>((uint64_t)(blocks[b] + 1) * BLOCK, now); more && seq-- > lo; ) more = visit(seq);
+            }
+        }
+
+        std::vector<std::string> result(top.size());
+        for(size_t i = top.size(); i-- > 0; top.pop()) result[i] = history[top.top().second - first];
+        return result;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace HISTORY {
+    class Store;
+
+    // Substring search over history for Ctrl-R. Trigrams are hashed into a fixed
+    // table of buckets, each listing the blocks of history entries that contain
+    // one of its trigrams; a query only looks at the blocks shared by all of its
+    // trigrams. Candidates are visited newest first, and the walk stops as soon
+    // as no older entry could outrank the current top results.
+    class SearchIndex {
+    public:
+        // `expected`: number of entries about to be added, to size the tables once.
+        explicit SearchIndex(size_t expected = 0);
+
+        // Entry number `seq` (entries are numbered in order, across evictions).
+        // `text` must stay valid until the entry is removed.
+        void add(std::string_view text, uint64_t seq);
+        // The oldest entry, number `seq`, left the history.
+        void remove(std::string_view text, uint64_t seq);
+
+        // Distinct lines containing `query`, best first, at most `limit`. Ranked by
+        // frecency: the number of uses, discounted by the age of the latest one.
+        // Entry i of `history` has number first + i.
+        std::vector<std::string> search(std::string_view query, size_t limit, const Store &history, uint64_t first) const;
+
+    private:
+        static const uint32_t BLOCK = 16;          // entries per posting
+        static const uint32_t BUCKET_BITS = 16;
+
+        // One per distinct line, pointing at its newest occurrence (the last
+        // one to be evicted). Open addressing, so a million lines cost one array.
+        struct Use {
+            const char *text = nullptr;   // nullptr = free slot
+            uint32_t len = 0;
+            uint32_t hash = 0;
+            uint32_t count = 0;
+            uint64_t last = 0;            // number of the newest occurrence
+        };
+
+        std::vector<Use> uses;             // power-of-two size, at most half full
+        size_t used = 0;
+        std::vector<std::vector<uint32_t>> buckets;   // ascending block numbers
+        uint32_t max_count = 1;
+        size_t live = 0;          // entries in the index
+        size_t stale = 0;         // evicted entries still in the buckets
+
+        size_t find(std::string_view text, uint32_t hash) const;
+        void grow();
+        void compact(uint64_t first);
+    };
+}
@@ -0,0 +1,307 @@
+#include "index_cache.h"
+#include "path_hash.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace IndexCache {
+    // Bump when the layout below or Trie::TrieNode::Node changes.
+    static const uint32_t VERSION = 2;
+    static const char MAGIC[8] = {'S','H','I','D','X','\0','\0','\0'};
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_size;     // sizeof(Trie::TrieNode::Node), guards against ABI changes
+        uint64_t file_size;
+        uint64_t builtins_hash;
+        uint64_t dir_count, dirs_off;
+        uint64_t strings_off, strings_len;
+        uint64_t nodes_off, node_count;
+        uint64_t children_off, chars_off, child_count;
+        uint64_t labels_off, labels_len;
+        uint64_t name_count;
+    };
+
+    struct DirRecord {
+        uint64_t dev, ino;
+        int64_t mtime_sec, mtime_nsec;
+        int64_t scanned_sec;            // when the names were listed
+        uint64_t path_off, path_len;    // into the strings blob
+        uint64_t names_off, names_len;  // '\0'-terminated names, into the strings blob
+    };
+
+    struct DirKey {
+        uint64_t dev = 0, ino = 0;
+        int64_t mtime_sec = 0, mtime_nsec = 0;
+        int64_t scanned_sec = 0;
+        bool ok = false;
+    };
+
+    static DirKey stat_dir(const fs::path &dir) {
+        DirKey key;
+        struct stat st;
+        if(stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return key;
+        key.dev = st.st_dev;
+        key.ino = st.st_ino;
+        key.mtime_sec = st.st_mtim.tv_sec;
+        key.mtime_nsec = st.st_mtim.tv_nsec;
+        key.ok = true;
+        return key;
+    }
+
+    static uint64_t fnv1a(const std::vector<std::string> &items) {
+        uint64_t h = 1469598103934665603ULL;
+        for(auto &s: items) {
+            for(unsigned char c: s) { h ^= c; h *= 1099511628211ULL; }
+            h ^= 0xff; h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    std::string default_path() {
+        if(const char* p = std::getenv("SHELL_INDEX_CACHE")) return p;
+        if(const char* p = std::getenv("XDG_CACHE_HOME")) return std::string(p) + "/shell-cpp/completion.idx";
+        if(const char* p = std::getenv("HOME")) return std::string(p) + "/.cache/shell-cpp/completion.idx";
+        return "";
+    }
+
+    std::vector<std::string> scan_directory(const fs::path &dir) {
+        std::vector<std::string> names;
+        std::error_code ec;
+        // Missing or unreadable PATH entries are skipped silently, like bash.
+        for(fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if(PathHash::is_executable(it->path().string())) {
+                names.push_back(it->path().filename().string());
+            }
+        }
+        return names;
+    }
+
+    // A read-only mapping of a cache file, validated so that every offset is in bounds.
+    struct Mapping {
+        const char* base = nullptr;
+        size_t size = 0;
+        const Header* header() const { return reinterpret_cast<const Header*>(base); }
+        const DirRecord* dirs() const { return reinterpret_cast<const DirRecord*>(base + header()->dirs_off); }
+        std::string_view str(uint64_t off, uint64_t len) const {
+            return std::string_view(base + header()->strings_off + off, len);
+        }
+    };
+
+    static bool in_bounds(uint64_t off, uint64_t len, size_t size) {
+        return off <= size && len <= size - off;
+    }
+
+    static bool map_file(const std::string &file, Mapping &m) {
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd == -1) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) { close(fd); return false; }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED) return false;
+        m.base = static_cast<const char*>(p);
+        m.size = st.st_size;
+
+        const Header* h = m.header();
+        using Node = Trie::TrieNode::Node;
+        bool ok = std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 && h->version == VERSION &&
+                  h->node_size == sizeof(Node) && h->file_size == m.size &&
+                  h->dir_count <= m.size / sizeof(DirRecord) && h->node_count > 0 &&
+                  h->node_count <= m.size / sizeof(Node) && h->child_count <= m.size / sizeof(uint32_t) &&
+                  in_bounds(h->dirs_off, h->dir_count * sizeof(DirRecord), m.size) &&
+                  in_bounds(h->strings_off, h->strings_len, m.size) &&
+                  in_bounds(h->nodes_off, h->node_count * sizeof(Node), m.size) &&
+                  in_bounds(h->children_off, h->child_count * sizeof(uint32_t), m.size) &&
+                  in_bounds(h->chars_off, h->child_count, m.size) &&
+                  in_bounds(h->labels_off, h->labels_len, m.size) &&
+                  h->nodes_off % alignof(Node) == 0 && h->children_off % alignof(uint32_t) == 0;
+        for(uint64_t i = 0; ok && i < h->dir_count; ++i) {
+            const DirRecord &d = m.dirs()[i];
+            ok = in_bounds(d.path_off, d.path_len, h->strings_len) && in_bounds(d.names_off, d.names_len, h->strings_len);
+        }
+        // Every node once, so the trie can trust the arrays: labels and child
+        // tables in bounds, child indices below the node count, and no node the
+        // child of two parents (nor the root of any), which rules out cycles.
+        if(ok) {
+            const Node* nodes = reinterpret_cast<const Node*>(m.base + h->nodes_off);
+            const uint32_t* children = reinterpret_cast<const uint32_t*>(m.base + h->children_off);
+            std::vector<bool> has_parent(h->node_count);
+            has_parent[0] = true;
+            for(uint64_t i = 0; ok && i < h->node_count; ++i) {
+                const Node &n = nodes[i];
+                ok = in_bounds(n.label_off, n.label_len, h->labels_len) && in_bounds(n.child_off, n.child_count, h->child_count);
+                for(uint32_t c = 0; ok && c < n.child_count; ++c) {
+                    uint32_t k = children[n.child_off + c];
+                    ok = k < h->node_count && !has_parent[k];
+                    if(ok) has_parent[k] = true;
+                }
+            }
+        }
+        if(!ok) {
+            munmap(const_cast<char*>(m.base), m.size);
+            m = Mapping();
+        }
+        return ok;
+    }
+
+    static void align(std::string &buf, size_t a) {
+        buf.resize((buf.size() + a - 1) / a * a, '\0');
+    }
+
+    static void write_cache(const std::string &file, const std::vector<fs::path> &dirs, const std::vector<DirKey> &keys,
+                            const std::vector<std::vector<std::string>> &dir_names, uint64_t builtins_hash,
+                            const Trie::TrieNode &trie, size_t name_count) {
+        using Node = Trie::TrieNode::Node;
+        std::string strings;
+        std::vector<DirRecord> records;
+        for(size_t i = 0; i < dirs.size(); ++i) {
+            if(!keys[i].ok) continue;   // don't cache missing directories; they get rechecked
+            DirRecord d{keys[i].dev, keys[i].ino, keys[i].mtime_sec, keys[i].mtime_nsec, keys[i].scanned_sec, 0, 0, 0, 0};
+            d.path_off = strings.size();
+            d.path_len = dirs[i].native().size();
+            strings += dirs[i].native();
+            d.names_off = strings.size();
+            for(auto &n: dir_names[i]) { strings += n; strings += '\0'; }
+            d.names_len = strings.size() - d.names_off;
+            records.push_back(d);
+        }
+
+        Header h{};
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.node_size = sizeof(Node);
+        h.builtins_hash = builtins_hash;
+        h.name_count = name_count;
+
+        std::string buf(sizeof(Header), '\0');
+        align(buf, 8);
+        h.dir_count = records.size();
+        h.dirs_off = buf.size();
+        buf.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(DirRecord));
+        h.strings_off = buf.size();
+        h.strings_len = strings.size();
+        buf += strings;
+        align(buf, alignof(Node));
+        h.nodes_off = buf.size();
+        h.node_count = trie.nodeCount();
+        for(size_t i = 0; i < trie.nodeCount(); ++i) buf.append(reinterpret_cast<const char*>(&trie.node(i)), sizeof(Node));
+        align(buf, alignof(uint32_t));
+        h.children_off = buf.size();
+        h.child_count = trie.childCount();
+        for(size_t i = 0; i < trie.childCount(); ++i) {
+            uint32_t c = trie.child(i);
+            buf.append(reinterpret_cast<const char*>(&c), sizeof(c));
+        }
+        h.chars_off = buf.size();
+        buf.append(reinterpret_cast<const char*>(trie.childChars()), trie.childCount());
+        h.labels_off = buf.size();
+        h.labels_len = trie.labelData().size();
+        buf.append(trie.labelData());
+        h.file_size = buf.size();
+        std::memcpy(buf.data(), &h, sizeof(h));
+
+        // Write-then-rename so concurrent shells only ever see a complete file.
+        std::error_code ec;
+        fs::create_directories(fs::path(file).parent_path(), ec);
+        std::string tmp = file + ".tmp." + std::to_string(getpid());
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd == -1) return;
+        size_t done = 0;
+        while(done < buf.size()) {
+            ssize_t n = write(fd, buf.data() + done, buf.size() - done);
+            if(n <= 0) break;
+            done += n;
+        }
+        close(fd);
+        if(done != buf.size() || rename(tmp.c_str(), file.c_str()) != 0) unlink(tmp.c_str());
+    }
+
+    Result load(const std::string &cache_file, const std::vector<fs::path> &dirs, const std::vector<std::string> &builtins) {
+        Result result;
+        uint64_t builtins_hash = fnv1a(builtins);
+        std::vector<DirKey> keys;
+        for(auto &dir: dirs) keys.push_back(stat_dir(dir));
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        Mapping m;
+        bool mapped = !cache_file.empty() && map_file(cache_file, m);
+
+        // Per PATH entry, the cached record that is still valid for it (or null).
+        std::vector<const DirRecord*> cached(dirs.size(), nullptr);
+        bool all_fresh = mapped && m.header()->builtins_hash == builtins_hash;
+        size_t live_dirs = 0;
+        for(size_t i = 0; i < dirs.size(); ++i) {
+            if(!keys[i].ok) continue;
+            live_dirs++;
+            for(uint64_t j = 0; mapped && j < m.header()->dir_count; ++j) {
+                const DirRecord &d = m.dirs()[j];
+                // Same racy rule as DirCache: mtime ticks coarsely, so a listing
+                // taken within a second of it may have missed a later entry.
+                if(d.dev == keys[i].dev && d.ino == keys[i].ino && d.mtime_sec == keys[i].mtime_sec &&
+                   d.mtime_nsec == keys[i].mtime_nsec && d.scanned_sec > d.mtime_sec + 1 &&
+                   m.str(d.path_off, d.path_len) == dirs[i].native()) {
+                    cached[i] = &d;
+                    keys[i].scanned_sec = d.scanned_sec;
+                    break;
+                }
+            }
+            if(!cached[i]) all_fresh = false;
+        }
+        if(all_fresh && m.header()->dir_count != live_dirs) all_fresh = false;
+
+        if(all_fresh) {
+            const Header* h = m.header();
+            Trie::TrieNode::Mapped view;
+            view.nodes = reinterpret_cast<const Trie::TrieNode::Node*>(m.base + h->nodes_off);
+            view.node_count = h->node_count;
+            view.children = reinterpret_cast<const uint32_t*>(m.base + h->children_off);
+            view.child_chars = reinterpret_cast<const unsigned char*>(m.base + h->chars_off);
+            view.child_count = h->child_count;
+            view.labels = m.base + h->labels_off;
+            view.labels_len = h->labels_len;
+            result.root = new Trie::TrieNode();
+            // The mapping stays alive for the life of the shell.
+            result.root->attach(view);
+            result.names = h->name_count;
+            result.from_cache = true;
+            return result;
+        }
+
+        std::vector<std::vector<std::string>> dir_names(dirs.size());
+        std::vector<std::string> names = builtins;
+        for(size_t i = 0; i < dirs.size(); ++i) {
+            if(cached[i]) {
+                std::string_view blob = m.str(cached[i]->names_off, cached[i]->names_len);
+                for(size_t p = 0; p < blob.size(); ) {
+                    size_t e = blob.find('\0', p);
+                    if(e == std::string_view::npos) e = blob.size();
+                    dir_names[i].emplace_back(blob.substr(p, e - p));
+                    p = e + 1;
+                }
+            } else if(keys[i].ok) {
+                keys[i].scanned_sec = now.tv_sec;
+                dir_names[i] = scan_directory(dirs[i]);
+                result.rescanned++;
+            }
+            names.insert(names.end(), dir_names[i].begin(), dir_names[i].end());
+        }
+        if(mapped) munmap(const_cast<char*>(m.base), m.size);
+
+        std::sort(names.begin(), names.end());
+        result.root = new Trie::TrieNode();
+        Trie::build(result.root, names);
+        result.names = names.size();
+        if(!cache_file.empty()) write_cache(cache_file, dirs, keys, dir_names, builtins_hash, *result.root, names.size());
+        return result;
+    }
+}
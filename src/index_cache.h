@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "trie.h"
+
+// On-disk cache of the PATH executable scan and the completion trie built
+// from it. The file is mmap'd read-only and the trie arrays are used in
+// place. Each PATH directory is keyed on dev/inode/mtime, so only
+// directories that changed since the cache was written get rescanned (and
+// those listed within a second of their mtime, which may have changed since).
+namespace IndexCache {
+    struct Result {
+        Trie::TrieNode* root = nullptr;
+        size_t names = 0;
+        size_t rescanned = 0;   // directories that had to be listed again
+        bool from_cache = false; // trie used straight from the mapping
+    };
+
+    // Default location: $SHELL_INDEX_CACHE, else $XDG_CACHE_HOME/shell-cpp/completion.idx,
+    // else ~/.cache/shell-cpp/completion.idx.
+    std::string default_path();
+
+    // Executable names directly inside `dir` (unsorted).
+    std::vector<std::string> scan_directory(const std::filesystem::path &dir);
+
+    // Load the index for `dirs` + `builtins` from `cache_file`, rescanning and
+    // rewriting the cache (atomically, via rename) when anything is stale.
+    Result load(const std::string &cache_file, const std::vector<std::filesystem::path> &dirs,
+                const std::vector<std::string> &builtins);
+}
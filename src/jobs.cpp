@@ -0,0 +1,450 @@
+#include "jobs.h"
+#include "trace.h"
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+namespace Jobs {
+    static std::map<int, Job> table;   // by job id
+    static bool job_control = false;
+    static int tty = -1;
+    static pid_t shell_pgid = 0;
+    static struct termios shell_modes;
+    static int sig_fd = -1;
+    static int wake_fd = -1;            // stage threads write here when they finish
+    static int last = 0;
+
+    void StageThreads::start(std::function<void()> fn) {
+        running->fetch_add(1);
+        threads.emplace_back([fn = std::move(fn), running = running] {
+            fn();
+            running->fetch_sub(1);
+            uint64_t one = 1;
+            if(wake_fd != -1) (void)!write(wake_fd, &one, sizeof(one));
+        });
+    }
+
+    void StageThreads::join() {
+        for(auto &t: threads) if(t.joinable()) t.join();
+        threads.clear();
+    }
+
+    StageThreads::StageThreads(StageThreads &&other) noexcept
+        : threads(std::move(other.threads)), running(std::move(other.running)), cancel(std::exchange(other.cancel, -1)) {}
+
+    StageThreads& StageThreads::operator=(StageThreads &&other) noexcept {
+        if(this != &other) {
+            join();
+            if(cancel != -1) close(cancel);
+            threads = std::move(other.threads);
+            running = std::move(other.running);
+            cancel = std::exchange(other.cancel, -1);
+        }
+        return *this;
+    }
+
+    StageThreads::~StageThreads() {
+        join();
+        if(cancel != -1) close(cancel);
+    }
+
+    int StageThreads::cancel_fd() {
+        if(cancel == -1) cancel = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return cancel;
+    }
+
+    // Stays readable from then on, so every stage sees it.
+    static void cancel_stages(StageThreads &stages) {
+        uint64_t one = 1;
+        if(stages.cancel != -1) (void)!write(stages.cancel, &one, sizeof(one));
+    }
+
+    void init(bool interactive) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+        sig_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if(!interactive || !isatty(STDIN_FILENO)) return;
+        // A private copy of the terminal: fd 0 may be a pipe by the time a
+        // spawned child's tcsetpgrp action runs.
+        tty = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        // Wait until we are in the foreground before taking the terminal over.
+        while(tcgetpgrp(tty) != (shell_pgid = getpgrp())) kill(-shell_pgid, SIGTTIN);
+        // Ctrl-C only reaches the shell while it holds the terminal itself, i.e.
+        // while a job runs nothing but in-process stages (see wait_stages).
+        sigaddset(&set, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+        signalfd(sig_fd, &set, 0);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        shell_pgid = getpid();
+        if(getpgrp() != shell_pgid) setpgid(shell_pgid, shell_pgid);
+        tcsetpgrp(tty, shell_pgid);
+        tcgetattr(tty, &shell_modes);
+        job_control = true;
+    }
+
+    pid_t spawn_pgroup(const Job &job) {
+        if(!job_control) return -1;
+        return job.pgid;
+    }
+
+    int spawn_tty(bool foreground) {
+        return (job_control && foreground) ? tty : -1;
+    }
+
+    void add_process(Job &job, pid_t pid) {
+        if(job_control) {
+            if(job.pgid == 0) job.pgid = pid;
+            // Also done by posix_spawn in the child; repeating it here closes the race.
+            setpgid(pid, job.pgid);
+        }
+        job.pids.push_back(pid);
+        job.exited.push_back(false);
+        int fd = syscall(SYS_pidfd_open, pid, 0);
+        job.pidfds.push_back(fd);   // -1 on kernels without pidfds: the signalfd still fires
+    }
+
+    static void close_pidfd(Job &job, size_t i) {
+        if(job.pidfds[i] != -1) close(job.pidfds[i]);
+        job.pidfds[i] = -1;
+    }
+
+    static int exit_code(int status) {
+        if(WIFEXITED(status)) return WEXITSTATUS(status);
+        if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        return 0;
+    }
+
+    // The exit status of a finished job's final stage.
+    static int result(const Job &job) {
+        return job.last_pid > 0 ? exit_code(job.status) : job.code->load();
+    }
+
+    // Wait for the in-process stages of a foreground job. SIGINT read from the
+    // signalfd is passed on to them through their cancel eventfd. Returns
+    // whether the job was interrupted.
+    static bool wait_stages(Job &job, bool interrupted) {
+        if(interrupted) cancel_stages(job.stages);
+        bool woken = false;
+        while(!job.stages.done()) {
+            struct pollfd fds[2] = {{sig_fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+            if(poll(fds, 2, -1) < 0) {
+                if(errno == EINTR) continue;
+                break;
+            }
+            uint64_t n;
+            if(fds[1].revents & POLLIN) woken |= read(wake_fd, &n, sizeof(n)) > 0;
+            struct signalfd_siginfo info;
+            while(read(sig_fd, &info, sizeof(info)) > 0) {
+                if(info.ssi_signo == SIGINT) interrupted = true;
+                else woken = true;
+            }
+            if(interrupted) cancel_stages(job.stages);
+        }
+        job.stages.join();
+        // What was read here may have been meant for a background job: let the
+        // prompt's reaper have a look too.
+        uint64_t one = 1;
+        if(woken) (void)!write(wake_fd, &one, sizeof(one));
+        return interrupted;
+    }
+
+    int wait_foreground(Job &job) {
+        if(job_control && job.pgid) tcsetpgrp(tty, job.pgid);
+        bool interrupted = false;
+        for(size_t i = 0; i < job.pids.size(); ++i) {
+            if(job.exited[i]) continue;
+            int status;
+            pid_t r;
+            do {
+                r = Trace::wait_child(job.pids[i], &status, job_control ? WUNTRACED : 0);
+            } while(r < 0 && errno == EINTR);
+            if(r < 0) {
+                job.exited[i] = true;
+                continue;
+            }
+            if(WIFSTOPPED(status)) {
+                job.state = Job::STOPPED;
+                break;
+            }
+            job.exited[i] = true;
+            if(job.pids[i] == job.last_pid) job.status = status;
+            interrupted |= WIFSIGNALED(status) && WTERMSIG(status) == SIGINT;
+            close_pidfd(job, i);
+        }
+        if(job_control) {
+            tcsetpgrp(tty, shell_pgid);
+            tcsetattr(tty, TCSADRAIN, &shell_modes);
+        }
+        if(job.state == Job::STOPPED) {
+            std::cout << '\n';
+            int id = add_background(std::move(job));
+            std::cout << "[" << id << "]+  Stopped                 " << table[id].text << '\n';
+            last = 128 + SIGTSTP;
+            return last;
+        }
+        // Stages still reading from a process killed by Ctrl-C (or from the
+        // terminal) are cancelled along with it.
+        interrupted = wait_stages(job, interrupted);
+        // The tty echoed ^C without a newline.
+        if(job_control && interrupted) std::cout << '\n';
+        last = result(job);
+        return last;
+    }
+
+    int add_background(Job &&job) {
+        int id = table.empty() ? 1 : table.rbegin()->first + 1;
+        job.id = id;
+        bool stopped = job.state == Job::STOPPED;
+        Job &stored = table[id] = std::move(job);
+        if(!stopped && job_control) {
+            std::cout << "[" << id << "] " << (stored.pids.empty() ? getpid() : stored.pids.back()) << '\n';
+        }
+        return id;
+    }
+
+    std::vector<int> watch_fds() {
+        std::vector<int> fds;
+        if(sig_fd != -1) fds.push_back(sig_fd);
+        if(wake_fd != -1) fds.push_back(wake_fd);
+        for(auto &[id, job]: table) {
+            for(int fd: job.pidfds) if(fd != -1) fds.push_back(fd);
+        }
+        return fds;
+    }
+
+    static std::string describe(const Job &job) {
+        if(job.state == Job::STOPPED) return "Stopped";
+        if(job.state == Job::RUNNING) return "Running";
+        if(job.last_pid > 0 && WIFSIGNALED(job.status)) return strsignal(WTERMSIG(job.status));
+        int code = result(job);
+        return code == 0 ? "Done" : "Exit " + std::to_string(code);
+    }
+
+    static char marker(int id) {
+        if(table.empty()) return ' ';
+        auto last_job = table.rbegin();
+        if(id == last_job->first) return '+';
+        if(table.size() > 1 && id == std::next(last_job)->first) return '-';
+        return ' ';
+    }
+
+    static std::string format(const Job &job) {
+        std::string state = describe(job);
+        if(state.size() < 24) state.append(24 - state.size(), ' ');
+        std::string line = "[";
+        line += std::to_string(job.id);
+        line += ']';
+        line += marker(job.id);
+        return line + "  " + state + job.text + "\n";
+    }
+
+    // Poll every table entry without blocking. Jobs whose processes and stages
+    // have all finished become DONE; returns the ids of those that just stopped.
+    static std::vector<int> poll() {
+        if(sig_fd != -1) {
+            struct signalfd_siginfo info;
+            while(read(sig_fd, &info, sizeof(info)) > 0) {}
+        }
+        if(wake_fd != -1) {
+            uint64_t n;
+            (void)!read(wake_fd, &n, sizeof(n));
+        }
+        std::vector<int> stopped;
+        for(auto &[id, job]: table) {
+            bool changed = false;
+            for(size_t i = 0; i < job.pids.size(); ++i) {
+                if(job.exited[i]) continue;
+                int status;
+                pid_t r = Trace::wait_child(job.pids[i], &status, WNOHANG | WUNTRACED | WCONTINUED);
+                if(r <= 0) {
+                    if(r < 0 && errno == ECHILD) job.exited[i] = true;
+                    continue;
+                }
+                if(WIFSTOPPED(status)) {
+                    if(job.state != Job::STOPPED) changed = true;
+                    job.state = Job::STOPPED;
+                } else if(WIFCONTINUED(status)) {
+                    job.state = Job::RUNNING;
+                } else {
+                    job.exited[i] = true;
+                    if(job.pids[i] == job.last_pid) job.status = status;
+                    close_pidfd(job, i);
+                }
+            }
+            bool all_exited = std::find(job.exited.begin(), job.exited.end(), false) == job.exited.end();
+            if(all_exited && job.stages.done()) {
+                job.stages.join();
+                job.state = Job::DONE;
+            } else if(changed) {
+                stopped.push_back(id);
+            }
+        }
+        return stopped;
+    }
+
+    // Poll, then drop finished jobs. Those and the newly stopped ones are
+    // reported when `report` is set.
+    static std::string update(bool report) {
+        std::vector<int> stopped = poll();
+        std::string out;
+        for(auto it = table.begin(); it != table.end(); ) {
+            bool done = it->second.state == Job::DONE;
+            if(report && (done || std::find(stopped.begin(), stopped.end(), it->first) != stopped.end())) {
+                out += format(it->second);
+            }
+            it = done ? table.erase(it) : std::next(it);
+        }
+        return out;
+    }
+
+    std::string reap() {
+        return update(job_control);
+    }
+
+    int last_status() {
+        return last;
+    }
+
+    void set_last_status(int status) {
+        last = status;
+    }
+
+    // %n, %+, %-, %% or a bare pid. Empty spec means the current job.
+    static Job* find_job(const char *spec, const char *who) {
+        update(false);
+        if(table.empty()) {
+            std::cerr << who << ": current: no such job\n";
+            return nullptr;
+        }
+        if(!spec || !std::strcmp(spec, "%%") || !std::strcmp(spec, "%+") || !std::strcmp(spec, "%")) return &table.rbegin()->second;
+        if(!std::strcmp(spec, "%-")) return table.size() > 1 ? &std::next(table.rbegin())->second : &table.rbegin()->second;
+        if(spec[0] == '%') {
+            auto it = table.find(std::atoi(spec + 1));
+            if(it != table.end()) return &it->second;
+        } else {
+            pid_t pid = std::atoi(spec);
+            for(auto &[id, job]: table) {
+                if(std::find(job.pids.begin(), job.pids.end(), pid) != job.pids.end()) return &job;
+            }
+        }
+        std::cerr << who << ": " << spec << ": no such job\n";
+        return nullptr;
+    }
+
+    int jobs_builtin(const std::vector<char*> &argv) {
+        bool pids = argv.size() > 2 && std::strcmp(argv[1], "-p") == 0;
+        // Finished jobs are listed as Done once, then dropped.
+        poll();
+        for(auto &[id, job]: table) {
+            if(pids) {
+                if(!job.pids.empty()) std::cout << job.pgid << '\n';
+            } else {
+                std::cout << format(job);
+            }
+        }
+        std::erase_if(table, [](const auto &entry) { return entry.second.state == Job::DONE; });
+        return 0;
+    }
+
+    static void resume(Job &job) {
+        if(job.pgid) kill(job_control ? -job.pgid : job.pids.front(), SIGCONT);
+        job.state = Job::RUNNING;
+    }
+
+    int fg_builtin(const std::vector<char*> &argv) {
+        if(!job_control) {
+            std::cerr << "fg: no job control\n";
+            return 1;
+        }
+        Job *job = find_job(argv.size() > 2 ? argv[1] : nullptr, "fg");
+        if(!job) return 1;
+        Job fg = std::move(*job);
+        table.erase(fg.id);
+        // Straight to the terminal: the builtin's captured stdout is only
+        // written out after the job is done.
+        std::string echo = fg.text + "\n";
+        (void)!write(STDOUT_FILENO, echo.data(), echo.size());
+        // Give the job the terminal before it continues, so it can read right away.
+        tcsetpgrp(tty, fg.pgid);
+        resume(fg);
+        return wait_foreground(fg);
+    }
+
+    int bg_builtin(const std::vector<char*> &argv) {
+        Job *job = find_job(argv.size() > 2 ? argv[1] : nullptr, "bg");
+        if(!job) return 1;
+        resume(*job);
+        std::cout << "[" << job->id << "]" << marker(job->id) << " " << job->text << " &\n";
+        return 0;
+    }
+
+    // Until the job is DONE, or one of its processes stops (seen under job
+    // control), which leaves it STOPPED in the table instead of hanging.
+    static int wait_job(Job &job) {
+        if(job.state == Job::STOPPED) return 128 + SIGTSTP;
+        for(size_t i = 0; i < job.pids.size(); ++i) {
+            if(job.exited[i]) continue;
+            int status;
+            pid_t r;
+            do {
+                r = Trace::wait_child(job.pids[i], &status, job_control ? WUNTRACED : 0);
+            } while(r < 0 && errno == EINTR);
+            if(r > 0 && WIFSTOPPED(status)) {
+                job.state = Job::STOPPED;
+                std::cout << format(job);
+                return 128 + WSTOPSIG(status);
+            }
+            job.exited[i] = true;
+            if(r > 0 && job.pids[i] == job.last_pid) job.status = status;
+            close_pidfd(job, i);
+        }
+        job.stages.join();
+        job.state = Job::DONE;
+        return result(job);
+    }
+
+    // Like bash: 0 after waiting for everything, else the last named job's
+    // status. A job that stops ends the wait with 128 + the signal.
+    int wait_builtin(const std::vector<char*> &argv) {
+        if(argv.size() <= 2) {
+            int status = 0;
+            for(auto &[id, job]: table) {
+                if(job.state == Job::STOPPED) continue;
+                status = wait_job(job);
+                if(job.state == Job::STOPPED) break;
+                status = 0;
+            }
+            std::erase_if(table, [](const auto &entry) { return entry.second.state == Job::DONE; });
+            return status;
+        }
+        int status = 0;
+        for(size_t i = 1; argv[i]; ++i) {
+            Job *job = find_job(argv[i], "wait");
+            if(!job) {
+                status = 127;
+                continue;
+            }
+            status = wait_job(*job);
+            if(job->state == Job::DONE) table.erase(job->id);
+        }
+        return status;
+    }
+}
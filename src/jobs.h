@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <sys/types.h>
+
+// Job control: every pipeline is a job with its own process group. The
+// foreground job is waited on directly; background jobs are reaped from
+// the prompt's event loop, which polls a SIGCHLD signalfd, one pidfd per
+// process and an eventfd that in-process stage threads ping when they end.
+namespace Jobs {
+    // In-process stages (builtin writers, streaming builtins) of one pipeline.
+    struct StageThreads {
+        std::vector<std::thread> threads;
+        std::shared_ptr<std::atomic<int>> running = std::make_shared<std::atomic<int>>(0);
+        int cancel = -1;   // eventfd the stages poll alongside their data; written on Ctrl-C
+
+        StageThreads() = default;
+        StageThreads(StageThreads &&other) noexcept;
+        StageThreads& operator=(StageThreads &&other) noexcept;
+        ~StageThreads();
+
+        void start(std::function<void()> fn);
+        bool done() const { return running->load() == 0; }
+        void join();
+        // The eventfd to hand to a stage, created on first use.
+        int cancel_fd();
+    };
+
+    struct Job {
+        enum State { RUNNING, STOPPED, DONE };
+        int id = 0;
+        pid_t pgid = 0;
+        std::vector<pid_t> pids;
+        std::vector<int> pidfds;
+        std::vector<bool> exited;
+        int status = 0;          // wait status of the final stage's process
+        pid_t last_pid = -1;     // the final stage's process, if it is one
+        // Otherwise the final stage's exit status, stored by whatever ran it
+        // (possibly a stage thread, after the job has moved into the table).
+        std::shared_ptr<std::atomic<int>> code = std::make_shared<std::atomic<int>>(0);
+        State state = RUNNING;
+        std::string text;
+        StageThreads stages;
+    };
+
+    // Block SIGCHLD for the signalfd and, when interactive, take over the
+    // terminal and ignore the job-control signals. SIGINT is blocked and read
+    // from the signalfd instead, so Ctrl-C can cancel in-process stages while
+    // the shell holds the terminal. Call before starting any thread.
+    void init(bool interactive);
+
+    // Process group new pipeline processes should join: 0 = make a new one,
+    // -1 = leave them in the shell's (non-interactive mode).
+    pid_t spawn_pgroup(const Job &job);
+    // Terminal to hand to a foreground job at spawn time, or -1.
+    int spawn_tty(bool foreground);
+    // Record a process launched for `job` (the first one becomes the group leader).
+    void add_process(Job &job, pid_t pid);
+
+    // Run `job` in the foreground: wait for its processes and threads. If it gets
+    // stopped (Ctrl-Z) it moves to the job table instead. Sets and returns $?.
+    int wait_foreground(Job &job);
+
+    // Put `job` in the table and print "[id] pid". Returns the job id.
+    int add_background(Job &&job);
+
+    // fds the prompt should watch, and the non-blocking reaper to run when one fires.
+    // reap() returns "[1]+  Done ..." lines to show the user.
+    std::vector<int> watch_fds();
+    std::string reap();
+
+    // $?: the status of the last foreground pipeline's final stage.
+    int last_status();
+    void set_last_status(int status);
+
+    // The jobs, fg, bg and wait builtins. Each returns an exit status.
+    int jobs_builtin(const std::vector<char*> &argv);
+    int fg_builtin(const std::vector<char*> &argv);
+    int bg_builtin(const std::vector<char*> &argv);
+    int wait_builtin(const std::vector<char*> &argv);
+}
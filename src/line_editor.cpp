@@ -0,0 +1,509 @@
+#include "line_editor.h"
+#include <iostream>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <cerrno>
+#include <algorithm>
+#include <string_view>
+
+namespace LineEditor {
+    // Raw mode for exactly the lifetime of one readLine call.
+    struct RawMode {
+        int fd;
+        struct termios saved;
+        bool active = false;
+        RawMode(int fd) : fd(fd) {
+            if(tcgetattr(fd, &saved) < 0) return;  // not a terminal: read as-is
+            struct termios raw = saved;
+            // No ISIG either: Ctrl-C at the prompt cancels the line instead of
+            // signalling the shell's process group.
+            raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            active = tcsetattr(fd, TCSANOW, &raw) == 0;
+        }
+        ~RawMode() {
+            if(active) tcsetattr(fd, TCSADRAIN, &saved);
+        }
+    };
+
+    Editor::Editor(int in_fd, int out_fd) : in_fd(in_fd), out_fd(out_fd) {}
+
+    // Block until some input arrives and append all of it to pending. Watched
+    // fds that fire meanwhile are handed to onWake without leaving the prompt.
+    bool Editor::fill() {
+        char buf[4096];
+        std::vector<struct pollfd> fds;
+        while(true) {
+            if(watchFds) {
+                fds.assign(1, {in_fd, POLLIN, 0});
+                for(int fd: watchFds()) fds.push_back({fd, POLLIN, 0});
+                if(poll(fds.data(), fds.size(), -1) < 0) {
+                    if(errno == EINTR) continue;
+                    return false;
+                }
+                bool woken = false;
+                for(size_t i = 1; i < fds.size(); ++i) woken |= fds[i].revents != 0;
+                if(woken && onWake) notify(onWake());
+                if(!fds[0].revents) continue;
+            }
+            ssize_t n = read(in_fd, buf, sizeof(buf));
+            if(n > 0) {
+                pending.append(buf, n);
+                return true;
+            }
+            if(n < 0 && errno == EINTR) continue;
+            return false;
+        }
+    }
+
+    // Decode one key from the front of pending. Returns KEY_NONE if an escape
+    // sequence is cut off at the end of the buffer.
+    Editor::Key Editor::decode(char &c) {
+        c = pending[0];
+        size_t used = 1;
+        Key key = KEY_CHAR;
+        switch(c) {
+            case '\r': case '\n': key = KEY_ENTER; break;
+            case '\t': key = KEY_TAB; break;
+            case 127: case 8: key = KEY_BACKSPACE; break;
+            case 1: key = KEY_HOME; break;        // Ctrl-A
+            case 2: key = KEY_LEFT; break;        // Ctrl-B
+            case 3: key = KEY_CTRL_C; break;
+            case 4: key = KEY_CTRL_D; break;
+            case 5: key = KEY_END; break;         // Ctrl-E
+            case 6: key = KEY_RIGHT; break;       // Ctrl-F
+            case 7: key = KEY_CTRL_G; break;
+            case 11: key = KEY_KILL_END; break;   // Ctrl-K
+            case 12: key = KEY_CLEAR; break;      // Ctrl-L
+            case 14: key = KEY_DOWN; break;       // Ctrl-N
+            case 16: key = KEY_UP; break;         // Ctrl-P
+            case 18: key = KEY_SEARCH; break;     // Ctrl-R
+            case 21: key = KEY_KILL_START; break; // Ctrl-U
+            case 23: key = KEY_KILL_WORD; break;  // Ctrl-W
+            case 27: {
+                if(pending.size() < 2) return KEY_NONE;
+                char kind = pending[1];
+                key = KEY_IGNORE;   // unknown sequences are swallowed rather than inserted
+                if(kind == '[') {
+                    // CSI: parameter bytes 0x30-0x3F, intermediate bytes 0x20-0x2F,
+                    // then one final byte 0x40-0x7E.
+                    size_t i = 2;
+                    while(i < pending.size() && pending[i] >= 0x30 && pending[i] <= 0x3f) i++;
+                    size_t params_end = i;
+                    while(i < pending.size() && pending[i] >= 0x20 && pending[i] <= 0x2f) i++;
+                    if(i == pending.size()) return KEY_NONE;
+                    if(pending[i] < 0x40 || pending[i] > 0x7e) {
+                        used = i;   // malformed: drop what was read, keep the odd byte
+                        break;
+                    }
+                    used = i + 1;
+                    std::string_view params(pending.data() + 2, params_end - 2);
+                    // `1;5D` is Ctrl-Left: modifiers after the `;` turn arrows into word moves.
+                    bool modified = params.find(';') != std::string_view::npos;
+                    switch(pending[i]) {
+                        case 'A': key = KEY_UP; break;
+                        case 'B': key = KEY_DOWN; break;
+                        case 'C': key = modified ? KEY_WORD_RIGHT : KEY_RIGHT; break;
+                        case 'D': key = modified ? KEY_WORD_LEFT : KEY_LEFT; break;
+                        case 'H': key = KEY_HOME; break;
+                        case 'F': key = KEY_END; break;
+                        case '~': {
+                            std::string_view n = params.substr(0, params.find(';'));
+                            if(n == "1" || n == "7") key = KEY_HOME;
+                            else if(n == "4" || n == "8") key = KEY_END;
+                            else if(n == "3") key = KEY_DELETE;
+                            break;
+                        }
+                    }
+                } else if(kind == 'O') {
+                    // SS3: ESC O x from keypads in application mode.
+                    if(pending.size() < 3) return KEY_NONE;
+                    used = 3;
+                    switch(pending[2]) {
+                        case 'A': key = KEY_UP; break;
+                        case 'B': key = KEY_DOWN; break;
+                        case 'C': key = KEY_RIGHT; break;
+                        case 'D': key = KEY_LEFT; break;
+                        case 'H': key = KEY_HOME; break;
+                        case 'F': key = KEY_END; break;
+                    }
+                } else if(kind == 'b' || kind == 'f' || kind == 127) {
+                    // Alt-b, Alt-f, Alt-Backspace
+                    used = 2;
+                    key = kind == 'b' ? KEY_WORD_LEFT : kind == 'f' ? KEY_WORD_RIGHT : KEY_KILL_WORD;
+                }
+                // Any other ESC x: drop the ESC alone, and x is decoded as typed.
+                break;
+            }
+            default:
+                if((unsigned char)c < 32) key = KEY_IGNORE;  // other control keys do nothing
+        }
+        pending.erase(0, used);
+        return key;
+    }
+
+    void Editor::insert(const std::string &text) {
+        line.insert(cursor, text);
+        cursor += text.size();
+        // Typing at the end of the line is just an echo; anything else redraws.
+        if(!dirty && cursor == line.size()) {
+            out += text;
+            rendered_cursor += text.size();
+        } else {
+            dirty = true;
+        }
+    }
+
+    // Print `text` on its own lines where the prompt was, then draw the prompt again below.
+    void Editor::notify(const std::string &text) {
+        if(text.empty()) return;
+        size_t rows = rendered_cursor / columns;
+        if(rows > 0) out += "\033[" + std::to_string(rows) + "A";
+        out += "\r\033[J";
+        out += text;
+        rendered_cursor = 0;
+        dirty = true;
+        flush();
+    }
+
+    void Editor::showHistory(size_t index) {
+        if(index == historySize()) line = saved_line;
+        else line = historyLine(index);
+        history_index = index;
+        cursor = line.size();
+        dirty = true;
+    }
+
+    // Show search result search_pos (or the failed state) as prompt + line.
+    void Editor::showMatch() {
+        bool found = search_pos < search_results.size();
+        if(found) line = search_results[search_pos];
+        else if(search_query.empty()) line = saved_line;
+        prompt = std::string(found || search_query.empty() ? "" : "failed ") + "(reverse-i-search)`" + search_query + "': ";
+        size_t at = search_query.empty() ? std::string::npos : line.find(search_query);
+        cursor = (at == std::string::npos) ? line.size() : at;
+        dirty = true;
+    }
+
+    // Leave search mode with the match as the line (keep) or the line from before.
+    void Editor::endSearch(bool keep) {
+        searching = false;
+        prompt = search_prompt;
+        if(!keep) line = saved_line;
+        cursor = line.size();
+        history_index = historySize ? historySize() : 0;
+        dirty = true;
+    }
+
+    // Keys while searching. Returns true if the key was used up; otherwise the
+    // search has ended and the key is handled as usual.
+    bool Editor::handleSearch(Key key, char c) {
+        switch(key) {
+            case KEY_CHAR:
+                search_query += c;
+                break;
+            case KEY_BACKSPACE:
+                if(search_query.empty()) return true;
+                search_query.pop_back();
+                break;
+            case KEY_SEARCH:
+                // Again: the next match down the ranking.
+                if(search_pos + 1 < search_results.size()) search_pos++;
+                else out += '\a';
+                showMatch();
+                return true;
+            case KEY_CTRL_G:
+                endSearch(false);
+                return true;
+            case KEY_CTRL_C:
+                endSearch(false);
+                return false;
+            default:
+                endSearch(true);
+                return false;
+        }
+        search_results = search(search_query);
+        search_pos = 0;
+        if(search_results.empty() && !search_query.empty()) out += '\a';
+        showMatch();
+        return true;
+    }
+
+    // Above this many candidates, ask before listing them.
+    static const size_t LIST_ASK_ABOVE = 100;
+
+    void Editor::handleTab() {
+        std::string before = line.substr(0, cursor);
+        Candidates c = complete ? complete(before) : Candidates{};
+        if(c.count == 0) {
+            out += '\a';
+        } else if(last_was_tab) {
+            // Second Tab: list the candidates under the line, then start a fresh prompt.
+            out += '\n';
+            list = std::move(c);
+            if(list.count > LIST_ASK_ABOVE) {
+                std::vector<std::string> best = list.top ? list.top(10) : std::vector<std::string>{};
+                if(!best.empty()) {
+                    std::string row = "most used:";
+                    for(auto &s: best) {
+                        if(row.size() + 2 + s.size() >= columns) break;
+                        row += "  ";
+                        row += s;
+                    }
+                    out += row;
+                    out += '\n';
+                }
+                out += "Display all " + std::to_string(list.count) + " possibilities? (y or n)";
+                listing = LIST_ASK;
+            } else {
+                showPage(rows - 1);
+            }
+            last_was_tab = false;
+            return;
+        } else if(c.count == 1) {
+            insert(c.prefix + c.suffix);
+        } else if(!c.prefix.empty()) {
+            insert(c.prefix);
+        } else {
+            out += '\a';
+            last_was_tab = true;
+            return;
+        }
+        last_was_tab = false;
+    }
+
+    // Pull as many candidates as fit in max_rows rows and lay them out in
+    // columns filled top to bottom. Ends the listing once they run out.
+    void Editor::showPage(size_t max_rows) {
+        std::vector<std::string> page;
+        size_t width = 0;
+        while(have_ahead || (list.next && list.next(list_ahead))) {
+            have_ahead = true;
+            size_t w = std::max(width, list_ahead.size() + 2);
+            size_t cols = std::max<size_t>(1, columns / w);
+            if(!page.empty() && page.size() + 1 > cols * max_rows) break;
+            width = w;
+            page.push_back(std::move(list_ahead));
+            have_ahead = false;
+        }
+        if(!page.empty()) {
+            size_t cols = std::max<size_t>(1, columns / width);
+            size_t nrows = (page.size() + cols - 1) / cols;
+            for(size_t r = 0; r < nrows; ++r) {
+                for(size_t col = 0; col < cols; ++col) {
+                    size_t i = col * nrows + r;
+                    if(i >= page.size()) break;
+                    out += page[i];
+                    if(i + nrows < page.size()) out.append(width - page[i].size(), ' ');
+                }
+                out += '\n';
+            }
+        }
+        if(have_ahead) {
+            out += "--More--";
+            listing = LIST_MORE;
+        } else {
+            endListing();
+        }
+    }
+
+    void Editor::endListing() {
+        listing = LIST_NONE;
+        list = Candidates{};
+        have_ahead = false;
+        out += prompt;
+        out += line;
+        rendered_cursor = prompt.size() + line.size();
+        dirty = cursor != line.size();
+    }
+
+    // Keys while a listing is waiting on the user. All of them are used up.
+    bool Editor::handleListing(Key key, char c) {
+        if(listing == LIST_ASK) {
+            out += '\n';
+            if(key == KEY_CHAR && (c == 'y' || c == 'Y' || c == ' ')) showPage(rows - 1);
+            else endListing();
+            return true;
+        }
+        out += "\r\033[K";   // wipe --More--
+        if(key == KEY_CHAR && (c == ' ' || c == 'y' || c == 'Y')) showPage(rows - 1);
+        else if(key == KEY_ENTER) showPage(1);
+        else endListing();
+        return true;
+    }
+
+    void Editor::handle(Key key, char c) {
+        if(key != KEY_TAB) last_was_tab = false;
+        switch(key) {
+            case KEY_CHAR: insert(std::string(1, c)); break;
+            case KEY_TAB: handleTab(); break;
+            case KEY_BACKSPACE:
+                if(cursor > 0) { line.erase(--cursor, 1); dirty = true; }
+                break;
+            case KEY_DELETE:
+                if(cursor < line.size()) { line.erase(cursor, 1); dirty = true; }
+                break;
+            case KEY_LEFT: if(cursor > 0) { cursor--; dirty = true; } break;
+            case KEY_RIGHT: if(cursor < line.size()) { cursor++; dirty = true; } break;
+            case KEY_WORD_LEFT:
+                while(cursor > 0 && line[cursor - 1] == ' ') cursor--;
+                while(cursor > 0 && line[cursor - 1] != ' ') cursor--;
+                dirty = true;
+                break;
+            case KEY_WORD_RIGHT:
+                while(cursor < line.size() && line[cursor] == ' ') cursor++;
+                while(cursor < line.size() && line[cursor] != ' ') cursor++;
+                dirty = true;
+                break;
+            case KEY_HOME: cursor = 0; dirty = true; break;
+            case KEY_END: cursor = line.size(); dirty = true; break;
+            case KEY_KILL_END: line.erase(cursor); dirty = true; break;
+            case KEY_KILL_START: line.erase(0, cursor); cursor = 0; dirty = true; break;
+            case KEY_KILL_WORD: {
+                size_t start = cursor;
+                while(start > 0 && line[start - 1] == ' ') start--;
+                while(start > 0 && line[start - 1] != ' ') start--;
+                line.erase(start, cursor - start);
+                cursor = start;
+                dirty = true;
+                break;
+            }
+            case KEY_CLEAR:
+                out += "\033[H\033[2J";
+                rendered_cursor = 0;
+                dirty = true;
+                break;
+            case KEY_UP:
+                if(historySize && history_index > 0) {
+                    if(history_index == historySize()) saved_line = line;
+                    showHistory(history_index - 1);
+                }
+                break;
+            case KEY_DOWN:
+                if(historySize && history_index < historySize()) showHistory(history_index + 1);
+                break;
+            case KEY_SEARCH:
+                if(!search) break;
+                searching = true;
+                search_prompt = prompt;
+                saved_line = line;
+                search_query.clear();
+                search_results.clear();
+                search_pos = 0;
+                showMatch();
+                break;
+            default: break;
+        }
+    }
+
+    // Rewrite prompt + line from the start of the prompt and put the cursor back.
+    void Editor::redraw() {
+        size_t rows = rendered_cursor / columns;
+        if(rows > 0) out += "\033[" + std::to_string(rows) + "A";
+        out += '\r';
+        out += prompt;
+        out += line;
+        out += "\033[J";
+        size_t end = prompt.size() + line.size();
+        size_t target = prompt.size() + cursor;
+        size_t up = end / columns - target / columns;
+        if(up > 0) out += "\033[" + std::to_string(up) + "A";
+        out += '\r';
+        if(target % columns) out += "\033[" + std::to_string(target % columns) + "C";
+        rendered_cursor = target;
+        dirty = false;
+    }
+
+    void Editor::flush() {
+        if(dirty) redraw();
+        size_t done = 0;
+        while(done < out.size()) {
+            ssize_t n = write(out_fd, out.data() + done, out.size() - done);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            done += n;
+        }
+        out.clear();
+    }
+
+    bool Editor::readLine(const std::string &prompt_text, std::string &result) {
+        std::cout.flush();
+        std::cerr.flush();
+        RawMode raw(in_fd);
+        struct winsize ws;
+        bool sized = ioctl(out_fd, TIOCGWINSZ, &ws) == 0;
+        columns = (sized && ws.ws_col > 0) ? ws.ws_col : 80;
+        rows = (sized && ws.ws_row > 1) ? ws.ws_row : 24;
+
+        prompt = prompt_text;
+        line.clear();
+        cursor = 0;
+        dirty = false;
+        last_was_tab = false;
+        history_index = historySize ? historySize() : 0;
+        saved_line.clear();
+        searching = false;
+        listing = LIST_NONE;
+        out = prompt;
+        rendered_cursor = prompt.size();
+
+        while(true) {
+            // Consume everything already buffered, then one write for the whole batch.
+            while(!pending.empty()) {
+                char c;
+                Key key = decode(c);
+                if(key == KEY_NONE) break;
+                if(listing != LIST_NONE && handleListing(key, c)) continue;
+                if(searching && handleSearch(key, c)) continue;
+                if(key == KEY_ENTER) {
+                    if(cursor != line.size()) {
+                        cursor = line.size();
+                        dirty = true;
+                    }
+                    if(dirty) redraw();
+                    out += '\n';
+                    flush();
+                    result = line;
+                    return true;
+                }
+                if(key == KEY_CTRL_C) {
+                    // Abandon the line and start over on a fresh prompt.
+                    if(cursor != line.size()) {
+                        cursor = line.size();
+                        dirty = true;
+                    }
+                    if(dirty) redraw();
+                    out += "^C\n";
+                    out += prompt;
+                    line.clear();
+                    cursor = 0;
+                    rendered_cursor = prompt.size();
+                    history_index = historySize ? historySize() : 0;
+                    saved_line.clear();
+                    continue;
+                }
+                if(key == KEY_CTRL_D && line.empty()) {
+                    out += '\n';
+                    flush();
+                    return false;
+                }
+                if(key == KEY_CTRL_D) key = KEY_DELETE;
+                handle(key, c);
+            }
+            flush();
+            if(!fill()) {
+                // End of input: hand back a partial line once, then report EOF.
+                if(!pending.empty() || !line.empty()) {
+                    pending.clear();
+                    out += '\n';
+                    flush();
+                    result = line;
+                    return true;
+                }
+                return false;
+            }
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <unistd.h>
+
+// Interactive line editor. The terminal is switched to raw mode once per
+// prompt, input is read in blocks and decoded from a buffer (escape
+// sequences included), and every screen update goes out as one write().
+namespace LineEditor {
+    // What Tab offers for the text left of the cursor. Nothing is enumerated
+    // until the candidates are actually listed.
+    struct Candidates {
+        std::string prefix;    // continuation every candidate shares
+        size_t count = 0;
+        std::string suffix = " ";  // ends the word when there is a single candidate
+        std::function<bool(std::string&)> next;               // all of them, sorted, one per call
+        std::function<std::vector<std::string>(size_t)> top;  // up to k, most used first
+    };
+
+    class Editor {
+    public:
+        Editor(int in_fd = STDIN_FILENO, int out_fd = STDOUT_FILENO);
+
+        // Returns false on end of input (Ctrl-D on an empty line, or EOF).
+        bool readLine(const std::string &prompt, std::string &line);
+
+        std::function<Candidates(const std::string&)> complete;
+        // History for Up/Down: number of entries and the text of entry i (0 = oldest).
+        std::function<size_t()> historySize;
+        std::function<std::string(size_t)> historyLine;
+        // Ctrl-R: history lines containing the query, best match first.
+        std::function<std::vector<std::string>(const std::string&)> search;
+        // Extra fds to watch while waiting for keys (job notifications). When one
+        // is readable onWake() runs; text it returns is printed above the prompt.
+        std::function<std::vector<int>()> watchFds;
+        std::function<std::string()> onWake;
+
+    private:
+        enum Key {
+            KEY_NONE, KEY_IGNORE, KEY_CHAR, KEY_ENTER, KEY_TAB, KEY_BACKSPACE, KEY_DELETE,
+            KEY_LEFT, KEY_RIGHT, KEY_WORD_LEFT, KEY_WORD_RIGHT, KEY_UP, KEY_DOWN, KEY_HOME, KEY_END,
+            KEY_CTRL_C, KEY_CTRL_D, KEY_CTRL_G, KEY_SEARCH, KEY_KILL_END, KEY_KILL_START, KEY_KILL_WORD, KEY_CLEAR
+        };
+
+        int in_fd, out_fd;
+        std::string pending;       // bytes read but not consumed yet (survives across lines)
+        std::string prompt, line;
+        size_t cursor = 0;
+        size_t rendered_cursor = 0; // terminal cursor, in columns from the start of the prompt
+        size_t columns = 80, rows = 24;
+        bool dirty = false;        // needs a full redraw
+        std::string out;           // everything to write at the end of this batch
+        size_t history_index = 0;
+        std::string saved_line;    // the line being edited before Up was pressed
+        bool last_was_tab = false;
+
+        // Reverse incremental search state. While searching, `prompt` shows the
+        // query and `line` the current match.
+        bool searching = false;
+        std::string search_query, search_prompt;
+        std::vector<std::string> search_results;
+        size_t search_pos = 0;
+
+        // Double-Tab listing: ASK waits for y/n before a large set, MORE for a
+        // key at the --More-- prompt between pages.
+        enum Listing { LIST_NONE, LIST_ASK, LIST_MORE };
+        Listing listing = LIST_NONE;
+        Candidates list;
+        std::string list_ahead;    // pulled but didn't fit on the last page
+        bool have_ahead = false;
+
+        bool fill();
+        Key decode(char &c);
+        void handle(Key key, char c);
+        void insert(const std::string &text);
+        void handleTab();
+        bool handleListing(Key key, char c);
+        void showPage(size_t max_rows);
+        void endListing();
+        void showHistory(size_t index);
+        void notify(const std::string &text);
+        bool handleSearch(Key key, char c);
+        void showMatch();
+        void endSearch(bool keep);
+        void redraw();
+        void flush();
+    };
+}
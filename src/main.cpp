@@ -8,14 +8,39 @@
 #include <filesystem>
 #include <regex>
 #include <fcntl.h>
+#include <algorithm>
+#include <charconv>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <span>
+#include <functional>
+#include <unordered_map>
 #include "trie.h"
 #include "command.h"
+#include "parser.h"
 #include "history.h"
+#include "path_hash.h"
+#include "spawner.h"
+#include "index_cache.h"
+#include "line_editor.h"
+#include "block_reader.h"
+#include "fd_builtins.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "dir_cache.h"
+#include "expand.h"
+#include "trace.h"
+#include "fd_buf.h"
+#include "bench.h"
+#include "builtins.h"
 
 namespace fs = std::filesystem;
-#define ESC_SEQ 27
-#define UP_CODE 'A'
-#define DOWN_CODE 'B'
 
 #ifdef _WIN32
   #include <windows.h>
@@ -30,158 +55,232 @@ namespace fs = std::filesystem;
   const char PATH_SEP = ':';
 #endif
 
-std::vector<std::string> builtins = {"pwd","exit","type","echo","cd","history"};
-std::vector<std::string> custom_executable = {};
 std::vector<fs::path> directories;
-std::vector<Command> history;
+HISTORY::Store history;
 fs::path home_env;
+bool interactive = true;
 
 const char* raw_env = std::getenv("PATH");
 const char* raw_home_env = std::getenv("HOME");
 const char* raw_history_env = std::getenv("HISTFILE");
+const char* raw_timing_env = std::getenv("SHELL_STARTUP_TIMING");
 
-bool isExecutable(const std::string& path){
-  if(!fs::exists(path) || !fs::is_regular_file(path)) return false;
+// Full completion index (builtins + PATH executables), published once by the
+// background scan. Until then Tab completes builtins only.
+std::atomic<Trie::TrieNode*> completion_index{nullptr};
+std::atomic<size_t> completion_index_size{0};
+std::atomic<size_t> completion_index_rescanned{0};
+std::atomic<double> completion_index_ms{0};
+const auto startup_begin = std::chrono::steady_clock::now();
 
-  auto perms = fs::status(path).permissions();
-  return ((perms & fs::perms::owner_exec) == fs::perms::owner_exec) ||
-         ((perms & fs::perms::group_exec) == fs::perms::group_exec) ||
-         ((perms & fs::perms::others_exec) == fs::perms::others_exec);
+double ms_since_startup() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startup_begin).count();
 }
 
-bool checkBuiltin(const std::string& command){
-  for(auto &s: builtins) {
-    if(s == command)return true;
-  }
-  return false;
+// Runs on its own thread and only touches its arguments and the atomics above,
+// so it is safe to leave running (detached) when the shell exits.
+void scan_path_executables(std::vector<fs::path> dirs, std::vector<std::string> names) {
+  // Unchanged PATH directories come straight from the mmap'd cache.
+  IndexCache::Result index = IndexCache::load(IndexCache::default_path(), dirs, names);
+  completion_index_size.store(index.names, std::memory_order_relaxed);
+  completion_index_rescanned.store(index.rescanned, std::memory_order_relaxed);
+  completion_index_ms.store(ms_since_startup(), std::memory_order_relaxed);
+  completion_index.store(index.root, std::memory_order_release);
 }
 
-std::vector<std::string> getCommandArgs(const std::string &command){
-  std::vector<std::string> tokens;
-  std::string token;
+// What a trie last picked up from `enable -f` / `enable -d`.
+struct BuiltinsSeen {
+  uint64_t generation = 0;
+  std::vector<std::string> names;
+};
 
-  char quoteChar = '\0';  // '\0' means not in quotes, '"' or '\'' means in that type of quote
-  bool escaped = false;
+// Bring a trie up to date with builtins loaded or removed since. A removed
+// name stays if it is also a command on PATH.
+void sync_loaded_builtins(Trie::TrieNode* root, BuiltinsSeen &seen) {
+  if(seen.generation == Builtins::generation()) return;
+  seen.generation = Builtins::generation();
+  std::vector<std::string> names = Builtins::names();
+  for(auto &name: seen.names) {
+    if(!Builtins::is_builtin(name) && PathHash::search_path(name).empty()) Trie::remove(root, name);
+  }
+  for(auto &name: names) {
+    if(!Trie::search(root, name)) Trie::insert(root, name);
+  }
+  seen.names = std::move(names);
+}
 
-  for(size_t i = 0; i < command.size() ; i++){
-    char c = command[i];
-    if(escaped){
-      token += c;
-      escaped = false;
-      continue;
-    }
-    
-    // Backslash escaping works:
-    // - Outside quotes: escapes any character
-    // - Inside double quotes: escapes any character
-    // - Inside single quotes: backslash has no special meaning
-    if(c == '\\'){
-      if(quoteChar == '\''){
-        token += c;
-      }else if(quoteChar == '\"') {
-        char next_char = (i+1 == command.size()) ? '\0' : command[i+1];
-        if(next_char == '\"' || next_char == '$' || next_char == '\\' || next_char == '\n' || next_char == '`') {
-          escaped = true;
-        }else {
-          token += c;
-        }
-      }else escaped = true;
-      continue;
-    }
-    
-    // If in quotes, only the matching quote char can end the quotes
-    if(quoteChar != '\0'){
-      if(c == quoteChar){
-        quoteChar = '\0';  // End quotes
-      } else {
-        token += c;
-      }
-    } else {
-      // Not in quotes
-      if(c == '\'' || c == '\"'){
-        quoteChar = c;  // Start quotes
-      } else if(std::isspace(c)){
-        if(!token.empty()) {
-          tokens.push_back(token);
-          token.erase();
-        }
-      } else {
-        token += c;
-      }
+Trie::TrieNode* completion_root(Trie::TrieNode* builtin_root) {
+  static BuiltinsSeen builtins_seen, index_seen;
+  sync_loaded_builtins(builtin_root, builtins_seen);
+  // Give a scan that is nearly done a moment to finish before settling for builtins.
+  for(int i = 0; i < 10; ++i) {
+    if(Trie::TrieNode* root = completion_index.load(std::memory_order_acquire)) {
+      sync_loaded_builtins(root, index_seen);
+      return root;
     }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return builtin_root;
+}
+
+// How many history lines start with each command name, for ranking
+// completions. Counted incrementally as history grows.
+std::unordered_map<std::string, size_t> command_uses;
+size_t command_uses_seen = 0;  // history number of the last line counted
+
+std::vector<std::string> most_used(Trie::TrieNode* root, const std::string &prefix, size_t k) {
+  size_t i = 0;
+  if(history.size() && command_uses_seen >= history.number(0)) i = command_uses_seen - history.number(0) + 1;
+  for(; i < history.size(); ++i) {
+    std::string_view text = history[i];
+    size_t start = text.find_first_not_of(" \t");
+    if(start == std::string_view::npos) continue;
+    size_t end = text.find_first_of(" \t|;&<>", start);
+    command_uses[std::string(text.substr(start, end == std::string_view::npos ? end : end - start))]++;
   }
+  if(history.size()) command_uses_seen = history.number(history.size() - 1);
 
-  if(!token.empty()) {
-    tokens.push_back(token);
+  std::vector<std::pair<size_t, std::string>> ranked;
+  for(auto &[name, count]: command_uses) {
+    if(name.compare(0, prefix.size(), prefix) == 0 && Trie::search(root, name)) ranked.emplace_back(count, name);
   }
-  return tokens;
+  k = std::min(k, ranked.size());
+  std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(), [](auto &a, auto &b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+  std::vector<std::string> best;
+  for(size_t j = 0; j < k; ++j) best.push_back(std::move(ranked[j].second));
+  return best;
 }
 
-std::vector<Command> parse_input(const std::vector<std::string> &tokens){
-  std::vector<Command> pipeline;
-  Command current_cmd;
+// Escape `text` for insertion into a word that is open in `quote` ('\0' if none).
+std::string escape_for(std::string_view text, char quote) {
+  std::string out;
+  for(char c: text) {
+    if(quote == '\'') {}
+    else if(quote == '"') { if(c == '"' || c == '\\' || c == '$' || c == '`') out += '\\'; }
+    else if(std::isspace((unsigned char)c) || std::strchr("\\'\"|&;<>()$`*?#", c)) out += '\\';
+    out += c;
+  }
+  return out;
+}
 
-  for (size_t i = 0; i < tokens.size(); ++i) {
-        if (tokens[i] == "|") {
-            pipeline.push_back(current_cmd);
-            current_cmd = Command(); // Reset for next command
-        } else {
-            current_cmd.args.push_back(tokens[i]);
-        }
+// Tab completion for the text left of the cursor. The word under the cursor
+// is unquoted the way getCommandArgs would. The first word of a command
+// completes from the command index, arguments of `cd` to directories, and
+// every other argument (redirection targets included) to paths.
+LineEditor::Candidates complete_line(const std::string &before, Trie::TrieNode* builtin_root) {
+  std::vector<std::string> words;  // earlier words of the command under the cursor
+  std::string word;
+  char quote = '\0';
+  bool escaped = false, in_word = false;
+  for(size_t i = 0; i < before.size(); ++i) {
+    char c = before[i];
+    if(escaped) {
+      word += c;
+      escaped = false;
+    } else if(quote) {
+      if(c == quote) quote = '\0';
+      else if(c == '\\' && quote == '"') escaped = true;
+      else word += c;
+    } else if(c == '\\') {
+      escaped = in_word = true;
+    } else if(c == '\'' || c == '"') {
+      quote = c;
+      in_word = true;
+    } else if(std::isspace((unsigned char)c)) {
+      if(in_word) words.push_back(std::move(word));
+      word.clear();
+      in_word = false;
+    } else if(c == '|' || c == ';' || (c == '&' && !(i > 0 && (before[i-1] == '>' || before[i-1] == '<')) && before[i+1] != '>')) {
+      words.clear();
+      word.clear();
+      in_word = false;
+    } else {
+      word += c;
+      in_word = true;
     }
-    if (!current_cmd.args.empty()) pipeline.push_back(current_cmd);
-    return pipeline;
-}
+  }
 
-bool external_command_run(const std::string &program, std::vector<char*> &argv){
+  LineEditor::Candidates c;
+  if(words.empty() && !quote && word.find('/') == std::string::npos) {
+    Trie::TrieNode* root = completion_root(builtin_root);
+    Trie::Completion found = Trie::complete(root, word);
+    c.prefix = std::move(found.prefix);
+    c.count = found.count;
+    auto names = std::make_shared<Trie::Completions>(root, word);
+    c.next = [names](std::string &name) { return names->next(name); };
+    c.top = [root, word](size_t k) { return most_used(root, word, k); };
+    return c;
+  }
 
-  for(auto &dir: directories){
-    fs::path full_path = dir / program; 
-    if(!isExecutable(full_path.string())) continue;;
-  
-    #ifdef _WIN32
-      std::string cmd = "\"" + full_path.string() + "\"";\
-      for(const auto &a: argv) {cmd += "\""; cmd += a; cmd += "\"";}
-      STARTUPINFOA si{};
-      PROCESS_INFORMATION pi{};
-      si.cb = sizeof(si);
-  
-      if (!CreateProcessA(nullptr, cmd.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi)) continue;
-  
-      CloseHandle(pi.hThread);
-      CloseHandle(pi.hProcess);
-  
-      return true;
-    #else
-      execvp(full_path.c_str(), argv.data());
-      exit(1);
-      return true;
-    #endif 
+  static const std::string_view redirects[] = {"<", ">", "1>", ">>", "1>>", "2>", "2>>", "&>", "&>>", "<>", ">|"};
+  bool redirect = !words.empty() && std::find(std::begin(redirects), std::end(redirects), words.back()) != std::end(redirects);
+  bool dirs_only = !redirect && words.size() >= 1 && words[0] == "cd";
+  size_t slash = word.rfind('/');
+  std::string dir = (slash == std::string::npos) ? "" : word.substr(0, slash + 1);
+  std::string_view base = std::string_view(word).substr(dir.size());
+  if(dir.starts_with("~/")) dir = home_env.string() + dir.substr(1);
 
+  auto matches = std::make_shared<DirCache::Matches>(DirCache::match(dir, base, dirs_only));
+  c.count = matches->count();
+  c.prefix = escape_for(matches->common(), quote);
+  if(c.count == 1) {
+    DirCache::Matches only = *matches;
+    std::string_view name;
+    bool is_dir = false;
+    only.next(name, is_dir);
+    c.suffix = is_dir ? "/" : (quote ? std::string(1, quote) + " " : " ");
   }
-  return false;
+  c.next = [matches](std::string &name) {
+    std::string_view n;
+    bool is_dir;
+    if(!matches->next(n, is_dir)) return false;
+    name.assign(n);
+    if(is_dir) name += '/';
+    return true;
+  };
+  return c;
 }
 
+bool checkBuiltin(std::string_view command){
+  return Builtins::is_builtin(command);
+}
 
-bool execute_command(const std::string &program, std::vector<char*> &argv) {
-  if (program == "exit") {
-    if(raw_history_env != NULL) HISTORY::write_history(raw_history_env, history);
+// Run a builtin, leaving its exit status in `status`. Returns false when the
+// shell should exit.
+bool execute_command(std::string_view program, std::vector<char*> &argv, int &status) {
+  status = 0;
+  switch(Builtins::lookup(program)) {
+  case Builtins::CMD_EXIT:
+    // The shell exits with $?, which `exit N` sets first.
+    status = Jobs::last_status();
+    if(argv.size() > 2) {
+      int n;
+      std::string_view arg = argv[1];
+      auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), n);
+      if(ec != std::errc() || end != arg.data() + arg.size()) {
+        std::cerr << "exit: " << arg << ": numeric argument required\n";
+        status = 2;
+      } else {
+        status = n & 0xff;
+      }
+    }
+    Jobs::set_last_status(status);
+    if(interactive && raw_history_env != NULL) history.append(raw_history_env);
     return false;
-  }
-  if(program == "pwd")
-  {
+  case Builtins::CMD_PWD: {
     fs::path cwd = fs::current_path();
     std::cout << cwd.string() << '\n';
-  } 
-  else if(program == "echo") 
-  {
+    break;
+  }
+  case Builtins::CMD_ECHO:
     for(size_t i = 1; i < argv.size()-1; ++i) {
       std::cout << argv[i] ;
       std::cout << ((i == argv.size()-2) ? '\n' : ' ');
     } 
-  } 
-  else if(program == "type") 
-  {
+    break;
+  case Builtins::CMD_TYPE:
     for(size_t i = 1; i < argv.size()-1; ++i){
       std::string arg = argv[i];
       if(checkBuiltin(arg))
@@ -190,20 +289,16 @@ bool execute_command(const std::string &program, std::vector<char*> &argv) {
       }
       else
       {
-        bool found = false;
-        for(auto dir: directories){
-          fs::path filePath = dir / arg;
-          if(isExecutable(filePath.string())){
-            std::cout<< arg << " is " << filePath.make_preferred().string() << '\n';
-            found = true;
-          }
-          if(found) break;
+        std::string full_path = PathHash::find(arg, false);
+        if(!full_path.empty()) std::cout << arg << " is " << fs::path(full_path).make_preferred().string() << '\n';
+        else {
+          std:: cout << arg <<": not found\n";
+          status = 1;
         }
-        if(!found) std:: cout << arg <<": not found\n";
       } 
     }
-  } 
-  else if(program == "cd") {
+    break;
+  case Builtins::CMD_CD:
     if(argv.size()>2){
       std::string new_dir = argv[1];
       if(new_dir == "~") new_dir = home_env.string();
@@ -211,226 +306,589 @@ bool execute_command(const std::string &program, std::vector<char*> &argv) {
         fs::current_path(new_dir);
       } catch (const fs::filesystem_error& e){
         std::cerr << "cd: " << new_dir << ": " << e.code().message() << '\n';
+        status = 1;
       }
     }
-  } else if (program == "history"){
-    // Support reading history from file using: history -r <file>
-    static int append_pointer = 0;
-    if (argv.size() > 3) {
-      if (std::string(argv[1]) == "-r" && argv[2]) {
-        std::string file_loc = argv[2];
-        HISTORY::read_history(file_loc, history);
-      } else if(std::string(argv[1]) == "-w" && argv[2]) {
-        std::string file_loc = argv[2];
-        HISTORY::write_history(file_loc, history);
-      } else if(std::string(argv[1]) == "-a" && argv[2]) {
-        std::string file_loc = argv[2];
-        HISTORY::append_history(file_loc, append_pointer, history);
-        append_pointer = history.size();
+    break;
+  case Builtins::CMD_HISTORY: {
+    // history -r|-w|-a|-n|--compact [file]; the file defaults to HISTFILE.
+    if (argv.size() > 2 && argv[1][0] == '-') {
+      std::string opt = argv[1];
+      const char *file = argv[2] ? argv[2] : raw_history_env;
+      if(file == NULL) {
+        std::cerr << "history: " << opt << ": no file given and HISTFILE is not set" << std::endl;
+        status = 1;
+      } else if (opt == "-r") {
+        history.read(file);
+      } else if(opt == "-w") {
+        history.write(file);
+      } else if(opt == "-a") {
+        history.append(file);
+      } else if(opt == "-n") {
+        history.read_new(file);
+      } else if(opt == "--compact") {
+        history.compact(file);
       } else {
-        std::cerr << "history: -r requires a filename" << std::endl;
+        std::cerr << "history: " << opt << ": invalid option" << std::endl;
+        status = 2;
       }
       return true;
     }
 
-    int start = 0;
-    if(argv.size() > 2) start = history.size() - std::stoi(argv[1]);
+    size_t start = 0;
+    if(argv.size() > 2) {
+      size_t n;
+      std::string_view arg = argv[1];
+      auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), n);
+      if(ec != std::errc() || end != arg.data() + arg.size()) {
+        std::cerr << "history: " << arg << ": numeric argument required\n";
+        status = 2;
+        return true;
+      }
+      start = history.size() - std::min(n, history.size());
+    }
     for(size_t i = start; i < history.size(); ++i) {
-      std::cout << '\t' << i + 1 << ' ';
-      for(auto &arg: history[i].args) std::cout << arg << ' ';
-      std::cout << '\n';
+      std::cout << '\t' << history.number(i) << ' ' << history[i] << '\n';
     }
-  } else 
-  {
-    //handle not builtin command
-    if(!external_command_run(program,argv)) std:: cout << program << ": not found\n";
+    break;
+  }
+  case Builtins::CMD_JOBS:
+    status = Jobs::jobs_builtin(argv);
+    break;
+  case Builtins::CMD_FG:
+    status = Jobs::fg_builtin(argv);
+    break;
+  case Builtins::CMD_BG:
+    status = Jobs::bg_builtin(argv);
+    break;
+  case Builtins::CMD_WAIT:
+    status = Jobs::wait_builtin(argv);
+    break;
+  case Builtins::CMD_TRACE:
+    status = Trace::builtin(argv);
+    break;
+  case Builtins::CMD_BENCH:
+    // Reached only as a later pipeline stage; execute_line handles `bench` up front.
+    std::cerr << "bench: must start the line\n";
+    status = 2;
+    break;
+  case Builtins::CMD_ENABLE:
+    status = Builtins::enable_builtin(argv);
+    break;
+  case Builtins::CMD_HASH: {
+    // hash [-r] [-d name...] [name...]
+    if(argv.size() == 2) {
+      auto entries = PathHash::entries();
+      if(entries.empty()) {
+        std::cout << "hash: hash table empty\n";
+      } else {
+        std::cout << "hits\tcommand\n";
+        for(auto &[name, entry]: entries) {
+          std::string hits = std::to_string(entry.hits);
+          std::cout << std::string(hits.size() < 4 ? 4 - hits.size() : 0, ' ') << hits << '\t' << entry.path << '\n';
+        }
+      }
+      return true;
+    }
+    size_t i = 1;
+    bool remove = false;
+    for(; argv[i] && argv[i][0] == '-'; ++i) {
+      std::string opt = argv[i];
+      if(opt == "-r") PathHash::reset();
+      else if(opt == "-d") remove = true;
+      else {
+        std::cerr << "hash: " << opt << ": invalid option\n";
+        status = 2;
+        return true;
+      }
+    }
+    for(; argv[i]; ++i) {
+      std::string name = argv[i];
+      bool ok = remove ? PathHash::remove(name) : PathHash::add(name);
+      if(!ok) {
+        std::cerr << "hash: " << name << ": not found\n";
+        status = 1;
+      }
+    }
+    break;
+  }
+  default:
+    // Only builtins get here; externals are always spawned by run_pipeline.
+    std::cout << program << ": not found\n";
+    status = 127;
   }
   return true;
 }
 
 
-char getChar() {
-  #ifdef _WIN32
-    return _getch();
-  #else
-    char buf = 0;
-    struct termios old  = {0};
-    if(tcgetattr(0, &old) < 0) perror("tcgetattr");
-    old.c_lflag &= ~ICANON; // Disable line buffering
-    old.c_lflag &= ~ECHO;   // Disable local echo
-    old.c_cc[VMIN] = 1;
-    old.c_cc[VTIME] = 0;
-    if (tcsetattr(0, TCSANOW, &old) < 0) perror("tcsetattr ICANON");
-    if (read(0, &buf, 1) < 0) perror("read()");
-    old.c_lflag |= ICANON;
-    old.c_lflag |= ECHO;
-    if (tcsetattr(0, TCSADRAIN, &old) < 0) perror("tcsetattr ~ICANON");
-    return buf;
-  #endif
+void write_all(int fd, std::string_view data) {
+  while(!data.empty()) {
+    ssize_t n = write(fd, data.data(), data.size());
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return;
+    data.remove_prefix(n);
+  }
+}
+
+// For threads that write into pipes: a reader that exits early must cost us
+// EPIPE, not a SIGPIPE that kills the shell. The signal is thread-directed,
+// so blocking it on the writing thread is enough.
+void block_sigpipe() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+// Output sink thread for a builtin stage feeding a pipe. It owns `fd`.
+void drain_to_fd(int fd, std::string data) {
+  block_sigpipe();
+  write_all(fd, data);
+  close(fd);
 }
 
-int main() {
-  std::cout << std::unitbuf;
-  std::cerr << std::unitbuf;
+// Run a builtin stage in-process. Its stdout goes to the shell's stdout
+// (out_fd == -1) through a block buffer flushed when the builtin returns. Into
+// a pipe it is captured in memory instead and handed to a writer thread, so
+// downstream stages can start meanwhile. With redirections, it goes wherever
+// they leave fd 1, and stderr gets a line buffer of its own.
+bool run_builtin_stage(Command &cmd, int out_fd, Jobs::StageThreads &writers, int &status) {
+  Trace::Span span("builtin", cmd.args[0]);
+  bool redirected = !cmd.redirects.empty();
+  int fds[REDIRECT_FD_BASE];
+  std::fill(std::begin(fds), std::end(fds), -1);
+  if(redirected) {
+    if(!cmd.open_redirects()) {
+      status = 1;
+      return true;
+    }
+    fds[1] = fcntl(out_fd != -1 ? out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    fds[2] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    cmd.apply_redirects(fds);
+    cmd.close_redirects();
+    // Builtins here only write to 1 and 2.
+    for(int i = 0; i < REDIRECT_FD_BASE; ++i) if(i != 1 && i != 2 && fds[i] != -1) close(fds[i]);
+  }
+
+  // Whatever the shell itself still has buffered goes out first.
+  std::cout.flush();
+  std::cerr.flush();
+  std::stringbuf captured;
+  FdBuf direct(redirected ? fds[1] : STDOUT_FILENO), err(fds[2], true);
+  std::streambuf *old_out = std::cout.rdbuf(out_fd != -1 ? static_cast<std::streambuf*>(&captured) : &direct);
+  std::streambuf *old_err = redirected ? std::cerr.rdbuf(&err) : nullptr;
+  bool cont = execute_command(cmd.args[0], cmd.argv, status);
+  std::cout.flush();
+  std::cerr.flush();
+  std::cout.rdbuf(old_out);
+  if(old_err) std::cerr.rdbuf(old_err);
 
-  std::string path_env(raw_env);
-  home_env = raw_home_env;
-  
-  if(raw_history_env != NULL) {
-    HISTORY::read_history(raw_history_env, history);
+  if(redirected && fds[2] != -1) close(fds[2]);
+  int pipe_to = -1;
+  if(out_fd != -1) pipe_to = redirected ? fds[1] : fcntl(out_fd, F_DUPFD_CLOEXEC, 0);
+  else if(redirected && fds[1] != -1) close(fds[1]);
+  if(pipe_to != -1) {
+    writers.start([fd = pipe_to, data = std::move(captured).str()] {
+      drain_to_fd(fd, std::move(data));
+    });
   }
+  return cont;
+}
 
-  std::stringstream ss(path_env);
-  std::string item;
-  while(std::getline(ss,item,PATH_SEP)){
-    if(!item.empty()){
-      directories.push_back(fs::path(item));
+// Start a streaming builtin (cat/head/tee/wc, parallel) on its own thread with
+// private copies of its fds, so it runs concurrently with the other stages.
+// body's exit status goes to `code` (the job's, for its final stage) if set.
+void run_fd_stage(Command &cmd, int in_fd, int out_fd, Jobs::StageThreads &threads,
+                  const std::shared_ptr<std::atomic<int>> &code, std::function<int(int, int, int)> body) {
+  if(!cmd.open_redirects()) {
+    if(code) code->store(1);
+    return;
+  }
+  int fds[REDIRECT_FD_BASE];
+  std::fill(std::begin(fds), std::end(fds), -1);
+  fds[0] = fcntl(in_fd != -1 ? in_fd : STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+  fds[1] = fcntl(out_fd != -1 ? out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  fds[2] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+  cmd.apply_redirects(fds);
+  cmd.close_redirects();
+  for(int i = 3; i < REDIRECT_FD_BASE; ++i) if(fds[i] != -1) close(fds[i]);
+  // The thread holds a reference to the line buffer for whatever body points into.
+  threads.start([in = fds[0], out = fds[1], err = fds[2], body = std::move(body), line = cmd.line, name = cmd.args[0], code] {
+    block_sigpipe();
+    Trace::Span span("stage", name);
+    int status = body(in, out, err);
+    if(code) code->store(status);
+    if(in != -1) close(in);
+    if(out != -1) close(out);
+    if(err != -1) close(err);
+  });
+}
+
+// The pipeline as `jobs` shows it.
+std::string job_text(const std::vector<Command> &pipeline) {
+  std::string text;
+  for(auto &cmd: pipeline) {
+    if(!text.empty()) text += " | ";
+    for(size_t j = 0; j < cmd.args.size(); ++j) {
+      if(j) text += ' ';
+      text += cmd.args[j];
     }
   }
+  return text;
+}
+
+void run_fd_builtin_stage(Command &cmd, int in_fd, int out_fd, Jobs::StageThreads &threads,
+                          const std::shared_ptr<std::atomic<int>> &code) {
+  // argv points into the line buffer, which the thread keeps alive.
+  run_fd_stage(cmd, in_fd, out_fd, threads, code, [argv = cmd.argv, cancel = threads.cancel_fd()](int in, int out, int err) {
+    return FdBuiltins::run(argv, in, out, err, cancel);
+  });
+}
+
+// parallel: options, the template and the program's path are settled here on
+// the shell's thread (the PATH hash isn't shared with stage threads); the
+// scheduler then runs as a streaming stage.
+void run_parallel_stage(Command &cmd, int in_fd, int out_fd, Jobs::StageThreads &threads,
+                        const std::shared_ptr<std::atomic<int>> &code) {
+  Parallel::Options opts;
+  auto fail = [&](int status) {
+    if(code) code->store(status);
+  };
+  if(!Parallel::parse(cmd.argv, opts, STDERR_FILENO)) return fail(2);
+  if(opts.command.size() == 1 && opts.command[0].find_first_of(" \t") != std::string::npos) {
+    // `parallel 'gzip -9 {}'`: a quoted template is split like an input line.
+    std::string text = std::move(opts.command[0]);
+    std::vector<std::string_view> words = getCommandArgs(text);
+    opts.command.assign(words.begin(), words.end());
+    for(auto word: words) opts.redirect.push_back(Command::is_redirect_token(word));
+  }
+  if(opts.command.empty()) return fail(2);
+  opts.program = PathHash::find(opts.command[0]);
+  if(opts.program.empty()) {
+    std::cerr << "parallel: " << opts.command[0] << ": not found\n";
+    return fail(127);
+  }
+  run_fd_stage(cmd, in_fd, out_fd, threads, code, [opts = std::move(opts)](int in, int out, int err) {
+    return Parallel::run(opts, in, out, err);
+  });
+}
+
+// Run one pipeline as a job. Returns false when the shell should exit.
+bool run_pipeline(const std::shared_ptr<const std::string> &line, std::span<const std::string_view> tokens, bool background,
+                  HereDocs &docs) {
+  std::vector<Command> pipeline = parse_input(line, tokens);
+  // A bad redirection anywhere stops the whole pipeline before anything starts.
+  for(auto &cmd: pipeline) {
+    if(!cmd.get_argv(&docs)) {
+      Jobs::set_last_status(2);
+      return true;
+    }
+  }
+  
+  size_t num_cmds = pipeline.size();
+  int pipe_fds[2];
+  PathHash::sync();
+  int prev_pipe_read = -1;
   
-  for(fs::path &dir: directories) {
-    try {
-      for(const auto &entry: fs::directory_iterator(dir)){
-        if(isExecutable(entry.path().string())) {
-          custom_executable.push_back(entry.path().filename().string());
+  // The processes, builtin output writers and streaming builtins of this line.
+  Jobs::Job job;
+  // Only needed if the job ends up in the table (stopped jobs included).
+  if(background || interactive) job.text = job_text(pipeline);
+  
+  // Children write to the same fds, so they must not overtake the shell's own output.
+  std::cout.flush();
+  std::cerr.flush();
+  for(size_t i = 0; i < num_cmds ; ++i) {
+    // O_CLOEXEC so pipe ends held by the shell (or a writer thread) never leak
+    // into later stages; the spawn dup2s clear it on the child's 0/1.
+    if(i < (num_cmds - 1)) pipe2(pipe_fds, O_CLOEXEC);
+    int out_fd = (i < num_cmds - 1) ? pipe_fds[1] : -1;
+    // $? is the final stage's status; the others' are dropped.
+    std::shared_ptr<std::atomic<int>> code = (i == num_cmds - 1) ? job.code : nullptr;
+    int status = 0;
+
+    // cat/head/tee/wc with an option they don't implement run from PATH.
+    bool fallback = !pipeline[i].args.empty() && FdBuiltins::is_fd_builtin(pipeline[i].args[0]) &&
+                    !FdBuiltins::supports(pipeline[i].argv) && !PathHash::find(std::string(pipeline[i].args[0]), false).empty();
+
+    if(pipeline[i].args.empty()) {
+      // `$EMPTY | cat`: the stage expanded to no words, nothing to launch
+    } else if(!checkBuiltin(pipeline[i].args[0]) || fallback) {
+      // External stages don't need a copy of the shell: resolve through the hash
+      // in the parent and posix_spawn with the pipe/redirections as file actions.
+      std::string full_path = PathHash::find(std::string(pipeline[i].args[0]));
+      if(full_path.empty()) {
+        std::cout << pipeline[i].args[0] << ": not found\n";
+        status = 127;
+      } else {
+        pid_t pid = Spawn::external(pipeline[i], full_path, prev_pipe_read, out_fd,
+                                    (i < num_cmds - 1) ? pipe_fds[0] : -1,
+                                    Jobs::spawn_pgroup(job), Jobs::spawn_tty(!background));
+        if(pid > 0) {
+          Jobs::add_process(job, pid);
+          if(code) job.last_pid = pid;
+        } else {
+          status = errno == 0 ? 1 : errno == ENOENT ? 127 : 126;
         }
       }
-    } catch (const fs::filesystem_error &e){
-      std::cerr << "Error: " << e.what() << std::flush;
+    } else if(FdBuiltins::is_fd_builtin(pipeline[i].args[0])) {
+      run_fd_builtin_stage(pipeline[i], prev_pipe_read, out_fd, job.stages, code);
+    } else if(pipeline[i].args[0] == "parallel") {
+      run_parallel_stage(pipeline[i], prev_pipe_read, out_fd, job.stages, code);
+    } else if(Builtins::Function fn = Builtins::loaded(pipeline[i].args[0])) {
+      run_fd_stage(pipeline[i], prev_pipe_read, out_fd, job.stages, code, [fn, argv = pipeline[i].argv](int in, int out, int err) mutable {
+        return fn(int(argv.size() - 1), argv.data(), in, out, err);
+      });
+    } else if(num_cmds > 1 && pipeline[i].args[0] == "exit") {
+      // Like bash, `exit` inside a pipeline doesn't end the shell.
+    } else {
+      // Builtins always run in the shell itself (no fork), so every stage sees
+      // and can change shell state, as with bash's lastpipe.
+      if(!run_builtin_stage(pipeline[i], out_fd, job.stages, status)) return false;
+    }
+    if(code && status) code->store(status);
+    if (prev_pipe_read != -1) close(prev_pipe_read);
+  
+    if (i < num_cmds - 1) {
+        close(pipe_fds[1]);       // CRITICAL: Close write end so reader gets EOF
+        prev_pipe_read = pipe_fds[0]; // Save read end for next child
     }
   }
-  // Make builtin Trie for auto complete
-  Trie::TrieNode* root = new Trie::TrieNode();
-  for(auto &cmd: builtins) {
-    Trie::insert(root,cmd);
-  } 
-  for(auto &custom_exe: custom_executable) {
-    Trie::insert(root,custom_exe);
+  if(job.pids.empty() && job.stages.threads.empty()) {
+    Jobs::set_last_status(background ? 0 : job.code->load());  // builtins only, already finished
+    return true;
   }
-  
-  while(true){
-    int counter = history.size();
-    std::cout << "$ ";
-    std::string input;
+  // Only this job's processes are waited for; background ones are left to the reaper.
+  if(background) {
+    Jobs::add_background(std::move(job));
+    Jobs::set_last_status(0);
+  } else {
+    Trace::Span span("wait");
+    Jobs::wait_foreground(job);
+  }
+  return true;
+}
 
-    char prev_char = '\0';
+// `bench ... pipeline`: time the rest of the line, run in the foreground
+// however many times was asked. Returns false when the shell should exit.
+bool run_bench(const std::shared_ptr<const std::string> &line, std::span<const std::string_view> tokens, HereDocs &docs) {
+  Bench::Options opts;
+  size_t start;
+  if(!Bench::parse(tokens, opts, start)) return true;
+  std::span<const std::string_view> pipeline = tokens.subspan(start);
+  std::string label;
+  for(auto word: pipeline) {
+    if(!label.empty()) label += ' ';
+    label += word;
+  }
+  // Every run reads the same here-doc bodies.
+  size_t first_doc = docs.next;
+  bool cont = true;
+  Bench::run(opts, label, [&](int &status) {
+    docs.next = first_doc;
+    cont = run_pipeline(line, pipeline, false, docs);
+    status = Jobs::last_status();
+    return cont && status != 128 + SIGINT;
+  });
+  return cont;
+}
+
+// Where here-doc bodies come from: the next input lines, prompted with "> "
+// when interactive. Set by the batch and interactive loops.
+std::function<bool(std::string&)> read_more;
+
+// Read the body of every `<<` / `<<-` on the line, in order. Runs before
+// expansion: an unquoted delimiter means `$` expands in the body.
+HereDocs read_heredocs(const std::string &line, const std::vector<uint8_t> &quoting, std::span<const std::string_view> tokens) {
+  HereDocs docs;
+  for(size_t i = 0; i < tokens.size(); ++i) {
+    Redirect r;
+    if(!Command::is_redirect_token(tokens[i])) continue;
+    Command::redirect_op(tokens[i], r);
+    if(!r.heredoc) continue;
+    bool strip_tabs = tokens[i].ends_with("<<-");
+    std::string_view delim;
+    if(i + 1 < tokens.size()) delim = tokens[++i];
+    bool literal = false;
+    if(delim.data() >= line.data() && delim.data() < line.data() + line.size()) {
+      size_t off = delim.data() - line.data();
+      for(size_t j = 0; j < delim.size(); ++j) literal |= quoting[off + j] != Expand::UNQUOTED;
+    }
+    auto body = std::make_shared<std::string>();
+    std::string text;
+    while(read_more && read_more(text)) {
+      std::string_view l = text;
+      if(strip_tabs) l.remove_prefix(std::min(l.size(), l.find_first_not_of('\t')));
+      if(l == delim) break;
+      *body += l;
+      *body += '\n';
+    }
+    if(!literal && body->find('$') != std::string::npos) *body = Expand::variables(*body, Jobs::last_status());
+    docs.bodies.push_back(std::move(body));
+  }
+  return docs;
+}
+
+// Run one input line: lists separated by `;`, or by `&` to run the one before
+// it in the background, each list being pipelines joined by `&&` and `||`.
+// Returns false when the shell should exit.
+bool execute_line(std::string input) {
+  // Recorded as typed, before tokenizing rewrites the buffer.
+  if(interactive) history.add(input);
+  Trace::Span span("line", input);
+  // One allocation holds the whole line; tokens, args and argv all point into it.
+  auto line = std::make_shared<std::string>(std::move(input));
+  std::vector<uint8_t> quoting;
+  std::vector<std::string_view> tokens = getCommandArgs(*line, &quoting);
+  HereDocs docs = read_heredocs(*line, quoting, tokens);
+  // Checked before anything runs, like bash: `a |` or `a && ; b` runs nothing.
+  if(std::string_view bad = misplaced_operator(tokens); !bad.empty()) {
+    report_error("syntax error near unexpected token `" + std::string(bad) + "'");
+    Jobs::set_last_status(2);
+    return true;
+  }
+
+  // Each pipeline is expanded just before it runs, so `false; echo $?` sees 1.
+  auto run = [&](std::span<const std::string_view> part, bool background) {
+    std::shared_ptr<const std::string> words = line;
+    std::vector<std::string_view> expanded_tokens;
+    if(Expand::needed(*line, quoting, part)) {
+      Trace::Span span("expand");
+      // Expanded words get a buffer of their own, which then owns every arg.
+      auto expanded = std::make_shared<std::string>();
+      expanded_tokens = Expand::words(*line, quoting, part, Jobs::last_status(), *expanded);
+      part = expanded_tokens;
+      words = std::move(expanded);
+    }
+    if(!part.empty() && part[0] == "bench") return run_bench(words, part, docs);
+    return part.empty() || run_pipeline(words, part, background, docs);
+  };
+  auto and_or = [](std::string_view t) { return is_operator(t, OP_AND) || is_operator(t, OP_OR); };
+
+  std::span<const std::string_view> rest(tokens);
+  while(!rest.empty()) {
+    size_t end = std::find_if(rest.begin(), rest.end(), [](std::string_view t) {
+      return is_operator(t, OP_BACKGROUND) || is_operator(t, OP_SEQUENCE);
+    }) - rest.begin();
+    bool background = end < rest.size() && is_operator(rest[end], OP_BACKGROUND);
+    std::span<const std::string_view> list = rest.first(end);
+    rest = rest.subspan(end < rest.size() ? end + 1 : end);
+    if(background && std::any_of(list.begin(), list.end(), and_or)) {
+      // That needs a copy of the shell to run the list; builtins run in this one.
+      report_error("&: && and || lists can't run in the background");
+      Jobs::set_last_status(2);
+      continue;
+    }
+    // `a && b || c`: each pipeline after the first runs or is skipped on the
+    // $? left by whatever ran before it.
+    const char *op = nullptr;
     while(true) {
-      char c = getChar();
-      if(c == '\t') {
-        auto [prefix,words] = Trie::autoComplete(root,input);
-        if(words.empty()) std::cout << '\a' << std::flush;
-        else if(prev_char == '\t') {
-          prev_char = '\0';
-          std::cout << '\n';
-          for(auto &s: words) {
-            std::cout << input << s << "  ";
-          }
-          std::cout << '\n';
-          std::cout << "$ " << input << std::flush;
-        } else {
-          if(!prefix.empty()) {
-            input += prefix;
-            std::string add =  ((words.size() == 1) ? " ":"");
-            input += add;
-            std::cout << prefix << add << std::flush;
-          } else {
-            std::cout << '\a' << std::flush;
-            prev_char = '\t';
-          }
-        } 
-      } else if( c == ESC_SEQ ){
-        char next1 = getChar(), next2 = getChar();
-        if(next1 == '[' && next2 == UP_CODE) {
-          if(counter > 0) {
-            counter--;
-            input.clear();
-            std::cout << "\r$ \033[K" << std::flush;
-            for(size_t i = 0; i < history[counter].args.size(); ++i) {
-              input += history[counter].args[i] ;
-              input += ((i != history[counter].args.size()-1) ? " " : "");
-            } 
-            std::cout << input << std::flush;
-          }
-        } else if(next1 == '[' && next2 == DOWN_CODE) {
-          if(counter < history.size() - 1) {
-            counter++;
-            input.clear();
-            std::cout << "\r$ \033[K" << std::flush;
-            for(size_t i = 0; i < history[counter].args.size(); ++i) {
-              input += history[counter].args[i] ;
-              input += ((i != history[counter].args.size()-1) ? " " : "");
-            } 
-            std::cout << input << std::flush;
-          }
-        }
-      }
-      else {
-        std::cout << c << std::flush;
-        if (c == '\r' || c == '\n')break;
-        else input += c;
-        prev_char = c;
-      }
+      size_t stop = std::find_if(list.begin(), list.end(), and_or) - list.begin();
+      bool wanted = !op || (op == OP_AND) == (Jobs::last_status() == 0);
+      if(wanted && !run(list.first(stop), background)) return false;
+      if(stop == list.size()) break;
+      op = list[stop].data();
+      list = list.subspan(stop + 1);
     }
+  }
+  return true;
+}
 
-    std::stringstream ss(input);
-
-    std::vector<std::string> tokens = getCommandArgs(input);
-    std::vector<Command> pipeline = parse_input(tokens);
-    
-    int num_cmds = pipeline.size();
-    int pipe_fds[2];
-    int prev_pipe_read = -1;
-    
-    for(size_t i = 0; i < num_cmds ; ++i) {
-      pipeline[i].get_argv();
-      history.push_back(pipeline[i]);
-      // If this is a single built-in command (no piping), run it in the parent
-      // so it can modify the shell state (e.g. `cd` changes parent's cwd, or `history -r` loads history).
-      bool is_parent_command = false;
-      if (num_cmds == 1 && !pipeline[i].args.empty()) {
-        if (pipeline[i].args[0] == "cd" || pipeline[i].args[0] == "exit") {
-          is_parent_command = true;
-        } else if (pipeline[i].args[0] == "history" && pipeline[i].args.size() > 1 && (pipeline[i].args[1] == "-r" || pipeline[i].args[1] == "-w" || pipeline[i].args[1] == "-a")) {
-          is_parent_command = true;
-        }
-      }
-      
-      if (is_parent_command) {
-        bool cont = execute_command(pipeline[i].args[0], pipeline[i].argv);
-        if (!cont) return 0;
-        break; // skip forking for this command; continue REPL
-      }
-      
-      if(i < (num_cmds - 1)) pipe(pipe_fds);
-      pid_t pid = fork();
-      if(pid == 0) {
-        if(prev_pipe_read != -1) {
-          dup2(prev_pipe_read,STDIN_FILENO);
-          close(prev_pipe_read);
-        }
+// Non-interactive mode: no prompt, no echo, no history, lines read in blocks.
+int run_batch(BlockReader &reader) {
+  std::string_view line;
+  read_more = [&reader](std::string &text) {
+    std::string_view next;
+    if(!reader.next(next)) return false;
+    text.assign(next);
+    return true;
+  };
+  while(reader.next(line)) {
+    Jobs::reap();  // no notifications without a prompt, just collect finished `&` jobs
+    if(!execute_line(std::string(line))) break;
+  }
+  return Jobs::last_status();
+}
 
-        if(!pipeline[i].out_file.empty()) {
-          pipeline[i].prepare_redirection();
-          if(i < num_cmds - 1) close(pipe_fds[1]);
-        } else if (i < num_cmds - 1) {
-          dup2(pipe_fds[1], STDOUT_FILENO);
-        }
+int main(int argc, char *argv[]) {
+  // Block-buffered stdout, line-buffered stderr; flushed before every child is
+  // started, before each prompt, when a builtin returns, and at exit. Never
+  // freed, so the at-exit flush of std::cout still has somewhere to go.
+  std::cout.rdbuf(new FdBuf(STDOUT_FILENO));
+  std::cerr.rdbuf(new FdBuf(STDERR_FILENO, true));
+  std::cerr.unsetf(std::ios::unitbuf);   // on by default for cerr
 
-        if(i< num_cmds - 1) {
-          close(pipe_fds[0]);
-          close(pipe_fds[1]);
-        }
+  std::string path_env(raw_env ? raw_env : "");
+  home_env = raw_home_env ? raw_home_env : "";
 
-        if(!execute_command(pipeline[i].argv[0], pipeline[i].argv)) {exit(1);return 0;}
-        exit(0);
-      } 
-      if (prev_pipe_read != -1) close(prev_pipe_read);
-    
-      if (i < num_cmds - 1) {
-          close(pipe_fds[1]);       // CRITICAL: Close write end so reader gets EOF
-          prev_pipe_read = pipe_fds[0]; // Save read end for next child
+  // `shell -c 'cmds'`, `shell script`, or stdin that isn't a terminal run in batch mode.
+  std::unique_ptr<BlockReader> batch;
+  if(argc > 2 && std::string(argv[1]) == "-c") {
+    batch = std::make_unique<BlockReader>(std::string(argv[2]));
+  } else if(argc > 1) {
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+      std::cerr << argv[1] << ": " << std::strerror(errno) << '\n';
+      return 127;
+    }
+    batch = std::make_unique<BlockReader>(fd);
+  } else if(!isatty(STDIN_FILENO)) {
+    batch = std::make_unique<BlockReader>(STDIN_FILENO);
+  }
+  interactive = !batch;
+  // Before any thread exists, so that they all inherit the SIGCHLD block.
+  Jobs::init(interactive);
+
+  std::stringstream ss(path_env);
+  std::string item;
+  while(std::getline(ss,item,PATH_SEP)){
+    if(!item.empty()){
+      directories.push_back(fs::path(item));
+    }
+  }
+  
+  PathHash::init(directories);
+  history.set_limits(std::getenv("HISTSIZE"), std::getenv("HISTFILESIZE"));
+  if(batch) return run_batch(*batch);
+
+  if(raw_history_env != NULL) history.load(raw_history_env);
+
+  // Builtins-only trie so Tab works before the PATH scan finishes.
+  Trie::TrieNode* builtin_root = new Trie::TrieNode();
+  std::vector<std::string> names = Builtins::names();
+  std::sort(names.begin(), names.end());
+  Trie::build(builtin_root, names);
+  std::thread(scan_path_executables, directories, names).detach();
+
+  LineEditor::Editor editor;
+  editor.complete = [&](const std::string &text) { return complete_line(text, builtin_root); };
+  editor.historySize = [] { return history.size(); };
+  editor.historyLine = [](size_t i) { return std::string(history[i]); };
+  editor.search = [](const std::string &query) { return history.search(query, 64); };
+  editor.watchFds = Jobs::watch_fds;
+  editor.onWake = Jobs::reap;
+  read_more = [&editor](std::string &text) { return editor.readLine("> ", text); };
+
+  bool prompt_timed = false, index_timed = false;
+  while(true){
+    if(raw_timing_env != NULL) {
+      // Time-to-first-prompt, then the index build once it has landed.
+      if(!prompt_timed) std::cerr << "startup: first prompt after " << ms_since_startup() << " ms\n";
+      prompt_timed = true;
+      if(!index_timed && completion_index.load(std::memory_order_acquire)) {
+        std::cerr << "startup: completion index ready after " << completion_index_ms.load()
+                  << " ms (" << completion_index_size.load() << " names, "
+                  << completion_index_rescanned.load() << " directories rescanned)\n";
+        index_timed = true;
       }
     }
-    while(wait(NULL)>0); //parents wait for all children
+    std::string input;
+    if(!editor.readLine("$ ", input)) {
+      // Ctrl-D / end of input behaves like `exit`.
+      if(raw_history_env != NULL) history.append(raw_history_env);
+      return Jobs::last_status();
+    }
+
+    if(!execute_line(std::move(input))) return Jobs::last_status();
   }
 }
@@ -0,0 +1,308 @@
+#include "parallel.h"
+#include "spawner.h"
+#include "command.h"
+#include "block_reader.h"
+#include "trace.h"
+#include <map>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+namespace Parallel {
+    using Clock = std::chrono::steady_clock;
+
+    static void report(int err_fd, const std::string &msg) {
+        std::string line = "parallel: " + msg + "\n";
+        (void)!write(err_fd, line.data(), line.size());
+    }
+
+    static bool write_all(int fd, const char *data, size_t len) {
+        while(len > 0) {
+            ssize_t n = write(fd, data, len);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool parse(const std::vector<char*> &argv, Options &opts, int err_fd) {
+        size_t i = 1;
+        for(; argv[i] && argv[i][0] == '-'; ++i) {
+            std::string_view arg = argv[i];
+            std::string_view value;
+            if(arg == "--") {
+                ++i;
+                break;
+            } else if(arg == "-k" || arg == "--keep-order") {
+                opts.keep_order = true;
+            } else if(arg == "-u" || arg == "--ungroup") {
+                opts.group = false;
+            } else if(arg == "--stats") {
+                opts.stats = true;
+            } else if(arg == "-j" || arg == "--jobs") {
+                if(!argv[i + 1]) {
+                    report(err_fd, std::string(arg) + ": option requires an argument");
+                    return false;
+                }
+                value = argv[++i];
+            } else if(arg.starts_with("-j")) {
+                value = arg.substr(2);
+            } else {
+                report(err_fd, std::string(arg) + ": invalid option");
+                return false;
+            }
+            if(!value.empty()) {
+                auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), opts.jobs);
+                if(ec != std::errc() || end != value.data() + value.size()) {
+                    report(err_fd, std::string(value) + ": invalid number of jobs");
+                    return false;
+                }
+            }
+        }
+        for(; argv[i] && std::strcmp(argv[i], ":::") != 0; ++i) opts.command.push_back(argv[i]);
+        if(argv[i]) {
+            opts.inputs_given = true;
+            for(++i; argv[i]; ++i) opts.inputs.push_back(argv[i]);
+        }
+        if(opts.command.empty()) {
+            report(err_fd, "usage: parallel [-j N] [-k] [-u] [--stats] command [args...] [::: inputs...]");
+            return false;
+        }
+        if(opts.jobs == 0) opts.jobs = std::max(1u, std::thread::hardware_concurrency());
+        return true;
+    }
+
+    // Replace the placeholders in one template word. Sets `used` if there were any.
+    static void expand(std::string &out, const std::string &word, std::string_view input, size_t seq, bool &used) {
+        size_t slash = input.rfind('/');
+        std::string_view base = (slash == std::string_view::npos) ? input : input.substr(slash + 1);
+        for(size_t i = 0; i < word.size(); ) {
+            std::string_view rest = std::string_view(word).substr(i);
+            if(rest.starts_with("{}")) {
+                out += input;
+                i += 2;
+            } else if(rest.starts_with("{.}")) {
+                size_t dot = base.rfind('.');
+                out += input.substr(0, (dot == std::string_view::npos || dot == 0) ? input.size() : input.size() - base.size() + dot);
+                i += 3;
+            } else if(rest.starts_with("{/}")) {
+                out += base;
+                i += 3;
+            } else if(rest.starts_with("{//}")) {
+                out += (slash == std::string_view::npos) ? std::string_view(".") : input.substr(0, slash);
+                i += 4;
+            } else if(rest.starts_with("{#}")) {
+                out += std::to_string(seq);
+                i += 3;
+            } else {
+                out += word[i++];
+                continue;
+            }
+            used = true;
+        }
+    }
+
+    // Build the task's command line in one buffer (like a parsed input line) and spawn it.
+    static pid_t launch(const Options &opts, std::string_view input, size_t seq, int in_fd, int out_fd, int close_fd) {
+        auto line = std::make_shared<std::string>();
+        std::vector<std::pair<size_t, size_t>> words;   // into line; npos = operator k of the template
+        words.reserve(opts.command.size() + 1);
+        bool used = false;
+        for(size_t k = 0; k < opts.command.size(); ++k) {
+            if(k < opts.redirect.size() && opts.redirect[k]) {
+                words.emplace_back(std::string::npos, k);
+                continue;
+            }
+            size_t start = line->size();
+            expand(*line, opts.command[k], input, seq, used);
+            words.emplace_back(start, line->size() - start);
+            line->push_back('\0');
+        }
+        if(!used) {
+            words.emplace_back(line->size(), input.size());
+            *line += input;
+            line->push_back('\0');
+        }
+        Command cmd;
+        cmd.args.reserve(words.size());
+        for(auto [at, n]: words) {
+            if(at == std::string::npos) cmd.args.push_back(Command::redirect_token(opts.command[n]));
+            else cmd.args.emplace_back(line->data() + at, n);
+        }
+        cmd.line = std::move(line);
+        cmd.get_argv();  // a `>` in the template redirects each task
+        return Spawn::external(cmd, opts.program, in_fd, out_fd, close_fd);
+    }
+
+    struct Task {
+        size_t seq = 0;
+        pid_t pid = -1;
+        int pidfd = -1;     // readable once the child exits
+        int out = -1;       // read end of the task's output pipe when grouping
+        bool exited = false;
+        int status = 0;
+        std::string output;
+        Clock::time_point start, end;
+    };
+
+    static double percentile(const std::vector<double> &sorted, double p) {
+        if(sorted.empty()) return 0;
+        size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    int run(const Options &opts, int in_fd, int out_fd, int err_fd) {
+        // Tasks must not eat the input list, so they read /dev/null.
+        int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        BlockReader reader(in_fd);
+        size_t next_input = 0;
+        auto next_arg = [&](std::string &arg) {
+            if(opts.inputs_given) {
+                if(next_input == opts.inputs.size()) return false;
+                arg = opts.inputs[next_input++];
+                return true;
+            }
+            std::string_view line;
+            if(!reader.next(line)) return false;
+            arg.assign(line);
+            return true;
+        };
+
+        std::vector<Task> running;
+        running.reserve(opts.jobs);
+        std::map<size_t, std::string> finished;   // -k: output waiting for earlier tasks
+        size_t next_emit = 1, seq = 0, failed = 0;
+        std::vector<double> latencies;
+        bool input_done = false;
+        auto begin = Clock::now();
+
+        auto emit = [&](size_t task_seq, std::string &&output) {
+            if(!opts.keep_order) {
+                write_all(out_fd, output.data(), output.size());
+                return;
+            }
+            finished.emplace(task_seq, std::move(output));
+            for(auto it = finished.begin(); it != finished.end() && it->first == next_emit; it = finished.erase(it), ++next_emit) {
+                write_all(out_fd, it->second.data(), it->second.size());
+            }
+        };
+
+        std::vector<struct pollfd> fds;
+        std::vector<std::pair<size_t, bool>> owners;   // (task index, is output pipe) per pollfd
+        char buf[1 << 16];
+        while(true) {
+            // A slot is refilled as soon as its task finishes, so long tasks never
+            // hold up short ones queued behind them.
+            std::string arg;
+            while(!input_done && running.size() < opts.jobs) {
+                if(!next_arg(arg)) {
+                    input_done = true;
+                    break;
+                }
+                Task task;
+                task.seq = ++seq;
+                task.start = Clock::now();
+                int pipe_fds[2] = {-1, -1};
+                if(opts.group && pipe2(pipe_fds, O_CLOEXEC) < 0) {
+                    report(err_fd, std::strerror(errno));
+                    failed++;
+                    emit(task.seq, {});
+                    continue;
+                }
+                task.pid = launch(opts, arg, task.seq, null_fd, opts.group ? pipe_fds[1] : out_fd, pipe_fds[0]);
+                if(pipe_fds[1] != -1) close(pipe_fds[1]);
+                if(task.pid < 0) {
+                    if(pipe_fds[0] != -1) close(pipe_fds[0]);
+                    failed++;
+                    emit(task.seq, {});
+                    continue;
+                }
+                task.out = pipe_fds[0];
+                task.pidfd = syscall(SYS_pidfd_open, task.pid, 0);
+                running.push_back(std::move(task));
+            }
+            if(running.empty()) break;
+
+            fds.clear();
+            owners.clear();
+            bool no_pidfd = false;
+            for(size_t i = 0; i < running.size(); ++i) {
+                Task &task = running[i];
+                if(task.out != -1) {
+                    fds.push_back({task.out, POLLIN, 0});
+                    owners.emplace_back(i, true);
+                }
+                if(!task.exited) {
+                    if(task.pidfd == -1) no_pidfd = true;
+                    else {
+                        fds.push_back({task.pidfd, POLLIN, 0});
+                        owners.emplace_back(i, false);
+                    }
+                }
+            }
+            // Without pidfds (old kernels) exits are picked up by polling waitpid.
+            if(poll(fds.data(), fds.size(), no_pidfd ? 10 : -1) < 0 && errno != EINTR) {
+                report(err_fd, std::strerror(errno));
+                break;
+            }
+            for(size_t k = 0; k < fds.size(); ++k) {
+                if(!fds[k].revents) continue;
+                Task &task = running[owners[k].first];
+                if(owners[k].second) {
+                    ssize_t n = read(task.out, buf, sizeof(buf));
+                    if(n > 0) task.output.append(buf, n);
+                    else if(n == 0 || errno != EINTR) {
+                        close(task.out);
+                        task.out = -1;
+                    }
+                }
+            }
+            for(auto &task: running) {
+                if(task.exited) continue;
+                if(Trace::wait_child(task.pid, &task.status, WNOHANG) == task.pid) {
+                    task.exited = true;
+                    task.end = Clock::now();
+                }
+            }
+
+            for(size_t i = 0; i < running.size(); ) {
+                Task &task = running[i];
+                if(!task.exited || task.out != -1) {
+                    ++i;
+                    continue;
+                }
+                if(task.pidfd != -1) close(task.pidfd);
+                if(!WIFEXITED(task.status) || WEXITSTATUS(task.status) != 0) failed++;
+                latencies.push_back(std::chrono::duration<double, std::milli>(task.end - task.start).count());
+                emit(task.seq, std::move(task.output));
+                running[i] = std::move(running.back());
+                running.pop_back();
+            }
+        }
+        if(null_fd != -1) close(null_fd);
+
+        if(opts.stats) {
+            double wall = std::chrono::duration<double>(Clock::now() - begin).count();
+            std::sort(latencies.begin(), latencies.end());
+            char line[256];
+            snprintf(line, sizeof(line),
+                     "%zu tasks (%zu failed) in %.3f s, %.1f tasks/s; latency p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms",
+                     seq, failed, wall, wall > 0 ? seq / wall : 0.0, percentile(latencies, 50),
+                     percentile(latencies, 90), percentile(latencies, 99), latencies.empty() ? 0.0 : latencies.back());
+            report(err_fd, line);
+        }
+        return static_cast<int>(std::min<size_t>(failed, 101));
+    }
+}
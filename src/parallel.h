@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// `parallel [-j N] [-k] [-u] [--stats] command [args...] [::: inputs...]`
+//
+// Runs the command template once per input (one line of stdin each, or the
+// words after :::), keeping N children in flight. {} in the template is
+// replaced by the input, {.} by the input without its extension, {/} by its
+// basename, {//} by its directory and {#} by the task number; with no
+// placeholder the input becomes the last argument. Children are spawned
+// directly (no sh -c), so the template is only tokenized once.
+namespace Parallel {
+    struct Options {
+        size_t jobs = 0;            // 0 = one per CPU
+        bool group = true;          // buffer each task's stdout and write it in one piece
+        bool keep_order = false;    // -k: emit output in input order
+        bool stats = false;         // --stats: throughput and latency summary on stderr
+        std::vector<std::string> command;   // template words
+        std::vector<bool> redirect;         // per template word: a redirection operator (quoted templates only)
+        std::string program;        // resolved path of command[0]
+        std::vector<std::string> inputs;    // from :::
+        bool inputs_given = false;
+    };
+
+    // Parse argv (NUL-terminated). Returns false after printing a usage error to err_fd.
+    bool parse(const std::vector<char*> &argv, Options &opts, int err_fd);
+
+    // Run every task. in_fd supplies input lines unless ::: was used. The fds are
+    // borrowed. Returns the number of failed tasks (at most 101), like GNU parallel.
+    int run(const Options &opts, int in_fd, int out_fd, int err_fd);
+}
@@ -0,0 +1,178 @@
+#include "parser.h"
+#include "expand.h"
+#include "trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+const char OP_PIPE[] = "|", OP_BACKGROUND[] = "&", OP_SEQUENCE[] = ";", OP_AND[] = "&&", OP_OR[] = "||";
+
+bool is_control_operator(std::string_view token) {
+  for(const char *op: {OP_PIPE, OP_BACKGROUND, OP_SEQUENCE, OP_AND, OP_OR}) {
+    if(is_operator(token, op)) return true;
+  }
+  return false;
+}
+
+std::string_view misplaced_operator(std::span<const std::string_view> tokens) {
+  bool empty = true;          // no word since the start or the last operator
+  std::string_view last;
+  for(auto t: tokens) {
+    if(!is_control_operator(t)) {
+      empty = false;
+      continue;
+    }
+    if(empty) return t;
+    empty = true;
+    last = t;
+  }
+  // Only `&` and `;` may end a line.
+  if(empty && !last.empty() && !is_operator(last, OP_BACKGROUND) && !is_operator(last, OP_SEQUENCE)) return "newline";
+  return {};
+}
+
+// The redirection operator starting at command[i], if any.
+static std::string_view redirect_at(std::string_view command, size_t i) {
+  for(std::string_view op: Command::REDIRECT_OPS) {
+    if(command.substr(i).starts_with(op)) return op;
+  }
+  return {};
+}
+
+std::vector<std::string_view> getCommandArgs(std::string &command, std::vector<uint8_t> *quoting){
+  Trace::Span span("getCommandArgs");
+  std::vector<std::string_view> tokens;
+  // Upper bound on the token count (quoted blanks only over-count), so the vector is allocated once.
+  size_t runs = 0;
+  for(size_t i = 0; i < command.size(); ++i) {
+    if(!std::isspace(command[i]) && (i == 0 || std::isspace(command[i-1]))) runs++;
+    if(std::strchr("&|;<>", command[i])) runs += 2;  // `a&b` is three tokens
+  }
+  tokens.reserve(runs);
+  char *buf = command.data();
+  size_t w = 0;       // write position; never passes the read position i
+  size_t start = 0;   // start of the current token
+  if(quoting) quoting->assign(command.size(), Expand::UNQUOTED);
+  bool first_unquoted = false;  // the current token's first byte, for `2>`
+  bool quoted = false;          // the current token had quotes, so `""` is a word too
+  auto put = [&](char c, uint8_t q) {
+    if(w == start) first_unquoted = q == Expand::UNQUOTED;
+    if(quoting) (*quoting)[w] = q;
+    buf[w++] = c;
+  };
+
+  auto finish = [&]() {
+    if(w > start || quoted) {
+      buf[w] = '\0';  // at most at index size(), which holds the terminator anyway
+      tokens.emplace_back(buf + start, w - start);
+      w++;
+    }
+    start = w;
+    quoted = false;
+  };
+
+  char quoteChar = '\0';  // '\0' means not in quotes, '"' or '\'' means in that type of quote
+  bool escaped = false;
+
+  for(size_t i = 0; i < command.size() ; i++){
+    char c = command[i];
+    if(escaped){
+      put(c, Expand::LITERAL);
+      escaped = false;
+      continue;
+    }
+    
+    // Backslash escaping works:
+    // - Outside quotes: escapes any character
+    // - Inside double quotes: escapes any character
+    // - Inside single quotes: backslash has no special meaning
+    if(c == '\\'){
+      if(quoteChar == '\''){
+        put(c, Expand::LITERAL);
+      }else if(quoteChar == '\"') {
+        char next_char = (i+1 == command.size()) ? '\0' : command[i+1];
+        if(next_char == '\"' || next_char == '$' || next_char == '\\' || next_char == '\n' || next_char == '`') {
+          escaped = true;
+        }else {
+          put(c, Expand::DOUBLE_QUOTED);
+        }
+      }else escaped = true;
+      continue;
+    }
+    
+    // If in quotes, only the matching quote char can end the quotes
+    if(quoteChar != '\0'){
+      if(c == quoteChar){
+        quoteChar = '\0';  // End quotes
+      } else {
+        put(c, quoteChar == '\'' ? Expand::LITERAL : Expand::DOUBLE_QUOTED);
+      }
+    } else {
+      // Not in quotes
+      if(c == '\'' || c == '\"'){
+        quoteChar = c;  // Start quotes
+        quoted = true;
+      } else if(c == '#' && w == start && !quoted){
+        break;  // Comment to end of line (also skips a script's #! line)
+      } else if(std::isspace(c)){
+        finish();
+      } else if(std::string_view op = redirect_at(command, i); !op.empty()){
+        // A redirection is a token of its own and takes a lone unquoted digit
+        // just before it as its fd (`2>`). It views Command's operator table.
+        bool fd = w == start + 1 && first_unquoted && std::isdigit((unsigned char)buf[start]) &&
+                  op[0] != '&' && op != "<<<";
+        std::string spelling = fd ? buf[start] + std::string(op) : std::string(op);
+        if(fd) w = start;
+        else finish();
+        tokens.push_back(Command::redirect_token(spelling));
+        i += op.size() - 1;
+      } else if(c == '&'){
+        // A control operator even without blanks around it. The token can't live
+        // in the buffer (the write position may not pass the read position), so
+        // it is a literal.
+        finish();
+        if(i + 1 < command.size() && command[i+1] == '&'){
+          tokens.emplace_back(OP_AND, 2);
+          i++;
+        } else {
+          tokens.emplace_back(OP_BACKGROUND, 1);
+        }
+      } else if(c == '|'){
+        finish();
+        if(i + 1 < command.size() && command[i+1] == '|'){
+          tokens.emplace_back(OP_OR, 2);
+          i++;
+        } else {
+          tokens.emplace_back(OP_PIPE, 1);
+        }
+      } else if(c == ';'){
+        finish();
+        tokens.emplace_back(OP_SEQUENCE, 1);
+      } else {
+        put(c, Expand::UNQUOTED);
+      }
+    }
+  }
+
+  finish();
+  return tokens;
+}
+
+std::vector<Command> parse_input(const std::shared_ptr<const std::string> &line, std::span<const std::string_view> tokens){
+  Trace::Span span("parse_input");
+  std::vector<Command> pipeline;
+  auto pipe = [](std::string_view t) { return is_operator(t, OP_PIPE); };
+  pipeline.reserve(std::count_if(tokens.begin(), tokens.end(), pipe) + 1);
+
+  // Each stage's args are sized exactly before they are filled.
+  for (size_t i = 0; i <= tokens.size(); ) {
+        size_t end = std::find_if(tokens.begin() + i, tokens.end(), pipe) - tokens.begin();
+        if (end == tokens.size() && end == i) break;  // no trailing empty stage
+        Command current_cmd;
+        current_cmd.line = line;
+        current_cmd.args.assign(tokens.begin() + i, tokens.begin() + end);
+        pipeline.push_back(std::move(current_cmd));
+        i = end + 1;
+    }
+    return pipeline;
+}
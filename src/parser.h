@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <memory>
+#include <cstdint>
+#include "command.h"
+
+// Control operators. getCommandArgs emits unquoted `|`, `&`, `;`, `&&` and `||`
+// as tokens that view these arrays rather than the line, so a token is an
+// operator by identity only: quoted or expanded text that reads "|" stays a word.
+extern const char OP_PIPE[], OP_BACKGROUND[], OP_SEQUENCE[], OP_AND[], OP_OR[];
+inline bool is_operator(std::string_view token, const char *op) { return token.data() == op; }
+bool is_control_operator(std::string_view token);
+
+// The first control operator with no command before it, or a trailing `|`,
+// `&&` or `||` (reported as "newline"). Empty when the tokens are well formed.
+std::string_view misplaced_operator(std::span<const std::string_view> tokens);
+
+// Tokenize `command` in place: unescaped bytes are compacted towards the front
+// and each token is NUL-terminated, so the returned views double as argv strings.
+// With `quoting`, how each kept byte was quoted is recorded for Expand.
+std::vector<std::string_view> getCommandArgs(std::string &command, std::vector<uint8_t> *quoting = nullptr);
+
+// Split tokens on the `|` operator into pipeline stages whose args point into `line`.
+std::vector<Command> parse_input(const std::shared_ptr<const std::string> &line, std::span<const std::string_view> tokens);
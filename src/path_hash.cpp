@@ -0,0 +1,118 @@
+#include "path_hash.h"
+#include "trace.h"
+#include <unordered_map>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <sys/inotify.h>
+  #include <climits>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace PathHash {
+    static std::vector<fs::path> directories;
+    static std::unordered_map<std::string, Entry> table;
+    static int inotify_fd = -1;
+
+    // One stat per candidate instead of exists + is_regular_file + status.
+    bool is_executable(const std::string &path) {
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0) return false;
+        if(!S_ISREG(st.st_mode)) return false;
+        return (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0;
+    }
+
+    void init(const std::vector<fs::path> &dirs) {
+        directories = dirs;
+        table.clear();
+    #ifdef __linux__
+        if(inotify_fd != -1) close(inotify_fd);
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(inotify_fd == -1) return;
+        for(auto &dir: directories) {
+            // Missing directories simply don't get a watch; a later mkdir won't be seen.
+            inotify_add_watch(inotify_fd, dir.c_str(),
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        }
+    #endif
+    }
+
+    void sync() {
+    #ifdef __linux__
+        if(inotify_fd == -1) {
+            // No watches available: behave like an uncached lookup.
+            table.clear();
+            return;
+        }
+        alignas(struct inotify_event) char buf[4096];
+        while(true) {
+            ssize_t n = read(inotify_fd, buf, sizeof(buf));
+            if(n <= 0) break;
+            for(char *p = buf; p < buf + n; ) {
+                auto *ev = reinterpret_cast<struct inotify_event*>(p);
+                if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_Q_OVERFLOW)) {
+                    table.clear();
+                } else if(ev->len > 0) {
+                    // A change in any PATH dir can alter which entry wins for this name.
+                    table.erase(ev->name);
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    #else
+        table.clear();
+    #endif
+    }
+
+    std::string search_path(const std::string &name) {
+        if(name.empty()) return "";
+        if(name.find('/') != std::string::npos) {
+            return is_executable(name) ? name : "";
+        }
+        for(auto &dir: directories) {
+            fs::path full_path = dir / name;
+            if(is_executable(full_path.string())) return full_path.string();
+        }
+        return "";
+    }
+
+    std::string find(const std::string &name, bool count_hit) {
+        Trace::Span span("PATH lookup", name);
+        if(name.find('/') != std::string::npos) return search_path(name);
+        auto it = table.find(name);
+        if(it == table.end()) {
+            if(!count_hit) return search_path(name);
+            std::string path = search_path(name);
+            if(path.empty()) return "";
+            it = table.emplace(name, Entry{path, 0}).first;
+        }
+        if(count_hit) it->second.hits++;
+        return it->second.path;
+    }
+
+    bool add(const std::string &name) {
+        if(name.find('/') != std::string::npos) return false;
+        std::string path = search_path(name);
+        if(path.empty()) return false;
+        table[name] = Entry{path, 0};
+        return true;
+    }
+
+    bool remove(const std::string &name) {
+        return table.erase(name) > 0;
+    }
+
+    void reset() {
+        table.clear();
+    }
+
+    std::vector<std::pair<std::string, Entry>> entries() {
+        std::vector<std::pair<std::string, Entry>> out(table.begin(), table.end());
+        std::sort(out.begin(), out.end(), [](auto &a, auto &b){ return a.first < b.first; });
+        return out;
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+
+// bash-style `hash` table: command name -> resolved absolute path.
+// Entries are filled on first lookup and dropped when inotify reports a
+// change for that name in any PATH directory.
+namespace PathHash {
+    struct Entry {
+        std::string path;
+        int hits = 0;
+    };
+
+    void init(const std::vector<std::filesystem::path> &dirs);
+
+    // Drain pending inotify events and invalidate affected entries.
+    void sync();
+
+    // Resolve `name` through the table (falls back to a PATH scan on miss).
+    // Returns an empty string when the command cannot be found. Without
+    // `count_hit` it only peeks, as `type` does: no hit is counted and a miss
+    // is scanned for but not hashed.
+    std::string find(const std::string &name, bool count_hit = true);
+
+    // Resolve without touching the table.
+    std::string search_path(const std::string &name);
+
+    bool add(const std::string &name);
+    bool remove(const std::string &name);
+    void reset();
+
+    std::vector<std::pair<std::string, Entry>> entries();
+
+    bool is_executable(const std::string &path);
+}
@@ -0,0 +1,75 @@
+#include "spawner.h"
+#include "trace.h"
+#include <spawn.h>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+extern char **environ;
+
+namespace Spawn {
+    pid_t external(Command &cmd, const std::string &path, int in_fd, int out_fd, int close_fd,
+                   pid_t pgroup, int tty_fd) {
+        Trace::Span span("posix_spawn", cmd.args[0]);
+        if(!cmd.open_redirects()) {
+            errno = 0;
+            return -1;
+        }
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        // Take the terminal before exec, so a child that reads at once isn't
+        // stopped with SIGTTIN before the parent's tcsetpgrp lands. First, while
+        // tty_fd still means the terminal and not a dup2 target.
+        if(tty_fd != -1) posix_spawn_file_actions_addtcsetpgrp_np(&actions, tty_fd);
+#endif
+
+        if(in_fd != -1) {
+            posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+            posix_spawn_file_actions_addclose(&actions, in_fd);
+        }
+        if(out_fd != -1) {
+            posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+            posix_spawn_file_actions_addclose(&actions, out_fd);
+        }
+        if(close_fd != -1) posix_spawn_file_actions_addclose(&actions, close_fd);
+        // Redirections come last so they win over the pipe, same as in the fork path.
+        cmd.add_spawn_actions(&actions);
+
+        // The shell blocks SIGCHLD and SIGINT (read from a signalfd) and ignores the
+        // job-control signals; children get a clean mask and default handlers.
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+        sigset_t mask, defaults;
+        sigemptyset(&mask);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        sigemptyset(&defaults);
+        for(int sig: {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE}) sigaddset(&defaults, sig);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        if(pgroup != -1) {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attr, pgroup);
+        }
+        posix_spawnattr_setflags(&attr, flags);
+
+        pid_t pid = -1;
+        int err = posix_spawn(&pid, path.c_str(), &actions, &attr, cmd.argv.data(), environ);
+        if(err == ENOEXEC) {
+            // No #! line: run it as a shell script, like execvp does.
+            std::vector<char*> sh_argv{const_cast<char*>("/bin/sh"), const_cast<char*>(path.c_str())};
+            sh_argv.insert(sh_argv.end(), cmd.argv.begin() + 1, cmd.argv.end());
+            err = posix_spawn(&pid, "/bin/sh", &actions, &attr, sh_argv.data(), environ);
+        }
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        cmd.close_redirects();
+        if(err != 0) {
+            report_error(std::string(cmd.args[0]) + ": " + std::strerror(err));
+            errno = err;
+            return -1;
+        }
+        Trace::spawned(pid, cmd.args[0]);
+        return pid;
+    }
+}
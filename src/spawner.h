@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+#include "command.h"
+
+// Launching external pipeline stages without fork(). posix_spawn uses
+// CLONE_VM|CLONE_VFORK under glibc, so the cost doesn't grow with the
+// shell's heap (history, completion index).
+namespace Spawn {
+    // Start `path` with cmd.argv. in_fd/out_fd become the child's stdin/stdout
+    // (-1 = inherit) and close_fd is closed in the child (-1 = none).
+    // pgroup: -1 = stay in the shell's process group, 0 = lead a new one,
+    // otherwise join that group. tty_fd (-1 = none) is handed to the child's
+    // group as the foreground terminal, for a foreground job under job control.
+    // Returns the child pid, or -1 after printing an error; errno is then the
+    // spawn's error, or 0 if a redirection couldn't be opened.
+    pid_t external(Command &cmd, const std::string &path, int in_fd, int out_fd, int close_fd,
+                   pid_t pgroup = -1, int tty_fd = -1);
+}
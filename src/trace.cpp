@@ -0,0 +1,170 @@
+#include "trace.h"
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+namespace Trace {
+    std::atomic<bool> enabled{false};
+
+    // Past this many events new ones are counted and dropped.
+    static const size_t MAX_EVENTS = 1 << 20;
+
+    struct Event {
+        const char* name;       // a span's static name, or nullptr for a child
+        std::string detail;     // span detail, or the child's command
+        uint64_t start, end;
+        pid_t pid, tid;
+        struct rusage ru;
+        int status;
+    };
+
+    static std::mutex lock;
+    static std::vector<Event> events;
+    static size_t dropped = 0;
+    static std::unordered_map<pid_t, std::pair<std::string, uint64_t>> running;  // pid -> (name, start)
+    static std::atomic<size_t> running_count{0};   // so reaping skips the lock when nothing is traced
+    static std::atomic<uint64_t> child_user_us{0}, child_sys_us{0};
+
+    uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    static void push(Event &&e) {
+        if(events.size() >= MAX_EVENTS) {
+            dropped++;
+            return;
+        }
+        events.push_back(std::move(e));
+    }
+
+    void record(const char* name, std::string_view detail, uint64_t start_ns, uint64_t end_ns) {
+        Event e{name, std::string(detail), start_ns, end_ns, getpid(), pid_t(syscall(SYS_gettid)), {}, 0};
+        std::lock_guard<std::mutex> guard(lock);
+        push(std::move(e));
+    }
+
+    void spawned(pid_t pid, std::string_view name) {
+        if(!enabled.load(std::memory_order_relaxed)) return;
+        std::lock_guard<std::mutex> guard(lock);
+        running[pid] = {std::string(name), now_ns()};
+        running_count = running.size();
+    }
+
+    static void reaped(pid_t pid, int status, const struct rusage &ru) {
+        uint64_t end = now_ns();
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = running.find(pid);
+        if(it == running.end()) return;   // started while tracing was off
+        push({nullptr, std::move(it->second.first), it->second.second, end, pid, pid, ru, status});
+        running.erase(it);
+        running_count = running.size();
+    }
+
+    static uint64_t tv_us(const struct timeval &tv) { return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec; }
+
+    pid_t wait_child(pid_t pid, int *status, int options) {
+        struct rusage ru;
+        pid_t r = wait4(pid, status, options, &ru);
+        if(r > 0 && (WIFEXITED(*status) || WIFSIGNALED(*status))) {
+            child_user_us.fetch_add(tv_us(ru.ru_utime), std::memory_order_relaxed);
+            child_sys_us.fetch_add(tv_us(ru.ru_stime), std::memory_order_relaxed);
+            if(running_count.load(std::memory_order_relaxed)) reaped(r, *status, ru);
+        }
+        return r;
+    }
+
+    void child_times(uint64_t &user_us, uint64_t &sys_us) {
+        user_us = child_user_us.load(std::memory_order_relaxed);
+        sys_us = child_sys_us.load(std::memory_order_relaxed);
+    }
+
+    static void json_string(std::ostream &out, std::string_view s) {
+        out << '"';
+        for(unsigned char c: s) {
+            if(c == '"' || c == '\\') out << '\\' << c;
+            else if(c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out << buf;
+            } else out << c;
+        }
+        out << '"';
+    }
+
+    static bool dump(const char* file) {
+        std::ofstream out(file);
+        if(!out) return false;
+        std::lock_guard<std::mutex> guard(lock);
+        pid_t shell = getpid();
+        out << "{\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << shell << ",\"args\":{\"name\":\"shell\"}}";
+        out.setf(std::ios::fixed);
+        out.precision(3);
+        for(auto &e: events) {
+            out << ",\n";
+            if(!e.name) {
+                out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << e.pid << ",\"args\":{\"name\":";
+                json_string(out, e.detail);
+                out << "}},\n";
+            }
+            out << "{\"name\":";
+            json_string(out, e.name ? std::string_view(e.name) : std::string_view(e.detail));
+            out << ",\"ph\":\"X\",\"ts\":" << e.start / 1e3 << ",\"dur\":" << (e.end - e.start) / 1e3
+                << ",\"pid\":" << e.pid << ",\"tid\":" << e.tid << ",\"args\":{";
+            if(e.name) {
+                if(!e.detail.empty()) {
+                    out << "\"detail\":";
+                    json_string(out, e.detail);
+                }
+            } else {
+                int code = WIFEXITED(e.status) ? WEXITSTATUS(e.status) : 128 + WTERMSIG(e.status);
+                out << "\"status\":" << code
+                    << ",\"utime_us\":" << tv_us(e.ru.ru_utime) << ",\"stime_us\":" << tv_us(e.ru.ru_stime)
+                    << ",\"maxrss_kb\":" << e.ru.ru_maxrss
+                    << ",\"voluntary_ctxsw\":" << e.ru.ru_nvcsw << ",\"involuntary_ctxsw\":" << e.ru.ru_nivcsw;
+            }
+            out << "}}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return bool(out);
+    }
+
+    int builtin(const std::vector<char*> &argv) {
+        std::string_view op = argv.size() > 2 ? argv[1] : "";
+        if(op == "on") {
+            enabled = true;
+        } else if(op == "off") {
+            enabled = false;
+        } else if(op == "clear") {
+            std::lock_guard<std::mutex> guard(lock);
+            events.clear();
+            running.clear();
+            running_count = 0;
+            dropped = 0;
+        } else if(op == "dump") {
+            if(argv.size() < 4) {
+                std::cerr << "trace: usage: trace dump FILE\n";
+                return 2;
+            } else if(!dump(argv[2])) {
+                std::cerr << "trace: " << argv[2] << ": cannot write\n";
+                return 1;
+            }
+        } else if(op.empty()) {
+            std::lock_guard<std::mutex> guard(lock);
+            std::cout << "trace: " << (enabled ? "on" : "off") << ", " << events.size() << " events";
+            if(dropped) std::cout << " (" << dropped << " dropped)";
+            std::cout << '\n';
+        } else {
+            std::cerr << "trace: " << op << ": expected on, off, dump FILE or clear\n";
+            return 2;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Execution tracing. Spans on the shell's threads and the lifetime and
+// rusage of every child are recorded while `trace on` is in effect and
+// written out by `trace dump FILE` as Chrome trace-event JSON (load it in
+// chrome://tracing or Perfetto). Off, a span is one relaxed load and
+// never allocates.
+namespace Trace {
+    extern std::atomic<bool> enabled;
+
+    uint64_t now_ns();
+    void record(const char* name, std::string_view detail, uint64_t start_ns, uint64_t end_ns);
+
+    // Times its scope. The detail is copied at the start (only when tracing
+    // is on), so it may point into a buffer that changes meanwhile.
+    class Span {
+    public:
+        explicit Span(const char* name, std::string_view detail = {}) {
+            if(!enabled.load(std::memory_order_relaxed)) return;
+            this->name = name;
+            this->detail = detail;
+            start = now_ns();
+        }
+        ~Span() { end(); }
+        // End early, before the scope does.
+        void end() {
+            if(!name) return;
+            record(name, detail, start, now_ns());
+            name = nullptr;
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+    private:
+        const char* name = nullptr;
+        std::string detail;
+        uint64_t start = 0;
+    };
+
+    // Note a child as started, named after its command.
+    void spawned(pid_t pid, std::string_view name);
+    // waitpid() done with wait4(), so a finished child's rusage (CPU time,
+    // max RSS, context switches) goes into the trace at no extra syscall.
+    pid_t wait_child(pid_t pid, int *status, int options);
+    // CPU time of every child reaped through wait_child so far, traced or not.
+    void child_times(uint64_t &user_us, uint64_t &sys_us);
+
+    // trace on|off|dump FILE|clear; no argument prints the state. Returns an exit status.
+    int builtin(const std::vector<char*> &argv);
+}
@@ -1,74 +1,323 @@
+
 #include "trie.h"
-#include <iostream>
+#include <algorithm>
+#include <string_view>
 
 namespace Trie {
+    using Node = TrieNode::Node;
+
     TrieNode::TrieNode() {
-        isLeaf = false;
+        nodes.emplace_back();
     }
-    TrieNode::~TrieNode() {
-        for(auto &pr: children){
-            delete pr.second;
-        }
+
+    void TrieNode::attach(const Mapped &m) {
+        nodes.clear();
         children.clear();
+        child_chars.clear();
+        labels.clear();
+        counts.clear();
+        mapped = m;
+    }
+
+    void TrieNode::detach() {
+        if(!isMapped()) return;
+        Mapped m = mapped;
+        mapped = Mapped();
+        nodes.assign(m.nodes, m.nodes + m.node_count);
+        children.assign(m.children, m.children + m.child_count);
+        child_chars.assign(m.child_chars, m.child_chars + m.child_count);
+        labels.assign(m.labels, m.labels_len);
+    }
+
+    size_t TrieNode::memoryUsage() const {
+        return nodes.capacity() * sizeof(Node) + children.capacity() * sizeof(uint32_t) +
+               child_chars.capacity() + labels.capacity() + counts.capacity() * sizeof(uint32_t);
+    }
+
+    uint32_t TrieNode::countWords(uint32_t i) const {
+        const Node &n = node(i);
+        uint32_t total = n.isLeaf;
+        for(uint32_t c = 0; c < n.child_count; ++c) total += countWords(child(n.child_off + c));
+        return counts[i] = total;
+    }
+
+    uint32_t TrieNode::wordCount(uint32_t i) const {
+        if(counts.size() != nodeCount()) {
+            counts.assign(nodeCount(), 0);
+            countWords(0);
+        }
+        return counts[i];
+    }
+
+    static std::string_view label(const TrieNode* t, const Node &n) {
+        return t->labelData().substr(n.label_off, n.label_len);
+    }
+
+    // Index into t->children of the child starting with c, or -1.
+    static long findChild(const TrieNode* t, const Node &n, unsigned char c) {
+        const unsigned char* first = t->childChars() + n.child_off;
+        const unsigned char* last = first + n.child_count;
+        const unsigned char* it = std::lower_bound(first, last, c);
+        if(it == last || *it != c) return -1;
+        return it - t->childChars();
+    }
+
+    // Add `child` to node `idx`. The table is moved to the end of the arena so it
+    // stays contiguous; the old slots are left behind (build() has none of these).
+    static void addChild(TrieNode* t, uint32_t idx, uint32_t child) {
+        Node n = t->nodes[idx];
+        unsigned char c = t->labels[t->nodes[child].label_off];
+        uint32_t off = t->children.size();
+        bool placed = false;
+        for(uint32_t i = 0; i < n.child_count; ++i) {
+            unsigned char ci = t->child_chars[n.child_off + i];
+            if(!placed && c < ci) {
+                t->children.push_back(child);
+                t->child_chars.push_back(c);
+                placed = true;
+            }
+            t->children.push_back(t->children[n.child_off + i]);
+            t->child_chars.push_back(ci);
+        }
+        if(!placed) {
+            t->children.push_back(child);
+            t->child_chars.push_back(c);
+        }
+        t->nodes[idx].child_off = off;
+        t->nodes[idx].child_count = n.child_count + 1;
+    }
+
+    static uint32_t newNode(TrieNode* t, std::string_view lbl, bool leaf) {
+        Node n;
+        n.label_off = t->labels.size();
+        n.label_len = lbl.size();
+        n.isLeaf = leaf;
+        t->labels.append(lbl);
+        t->nodes.push_back(n);
+        return t->nodes.size() - 1;
     }
 
     void insert(TrieNode* root, const std::string &key) {
-        TrieNode* curr = root;
-        for(const char &c: key) {
-            if(curr->children.find(c) == curr->children.end()) {
-                TrieNode* new_node = new TrieNode();
-                curr->children[c] = new_node;
-            } 
-            curr = curr->children[c];
+        root->detach();
+        root->counts.clear();
+        uint32_t idx = 0;
+        size_t pos = 0;
+        while(true) {
+            if(pos == key.size()) {
+                root->nodes[idx].isLeaf = true;
+                return;
+            }
+            long slot = findChild(root, root->nodes[idx], key[pos]);
+            if(slot == -1) {
+                uint32_t leaf = newNode(root, std::string_view(key).substr(pos), true);
+                addChild(root, idx, leaf);
+                return;
+            }
+            uint32_t child = root->children[slot];
+            std::string_view lbl = label(root, root->nodes[child]);
+            size_t common = 0;
+            while(common < lbl.size() && pos + common < key.size() && lbl[common] == key[pos + common]) common++;
+            if(common == lbl.size()) {
+                idx = child;
+                pos += common;
+                continue;
+            }
+            // Split the edge: `child` keeps the shared head, a new node takes the tail
+            // (reusing the same label bytes) together with the old children.
+            Node old = root->nodes[child];
+            Node tail = old;
+            tail.label_off += common;
+            tail.label_len -= common;
+            root->nodes.push_back(tail);
+            uint32_t tail_idx = root->nodes.size() - 1;
+
+            Node &head = root->nodes[child];
+            head.label_len = common;
+            head.isLeaf = (pos + common == key.size());
+            head.child_off = root->children.size();
+            head.child_count = 1;
+            root->children.push_back(tail_idx);
+            root->child_chars.push_back(root->labels[tail.label_off]);
+            if(pos + common < key.size()) {
+                uint32_t leaf = newNode(root, std::string_view(key).substr(pos + common), true);
+                addChild(root, child, leaf);
+            }
+            return;
         }
-        curr->isLeaf = true;
     }
 
-    bool search(TrieNode* root, const std::string &key) {
-        TrieNode* curr = root;
-        for(const char &c: key) {
-            if(curr->children.find(c) == curr->children.end()) return false;
-            curr = curr->children[c];
+    void remove(TrieNode* root, const std::string &key) {
+        root->detach();
+        std::vector<uint32_t> path{0};
+        size_t pos = 0;
+        while(pos < key.size()) {
+            long slot = findChild(root, root->nodes[path.back()], key[pos]);
+            if(slot == -1) return;
+            uint32_t child = root->children[slot];
+            std::string_view lbl = label(root, root->nodes[child]);
+            if(key.compare(pos, lbl.size(), lbl) != 0) return;
+            pos += lbl.size();
+            path.push_back(child);
+        }
+        if(!root->nodes[path.back()].isLeaf) return;
+        root->counts.clear();
+        root->nodes[path.back()].isLeaf = false;
+        // Unlink wordless nodes bottom-up. The parent's table shrinks in place;
+        // its last slot and the unlinked nodes are left behind as garbage.
+        for(size_t i = path.size() - 1; i > 0; --i) {
+            const Node &n = root->nodes[path[i]];
+            if(n.isLeaf || n.child_count) break;
+            Node &parent = root->nodes[path[i - 1]];
+            auto &kids = root->children;
+            size_t end = parent.child_off + parent.child_count;
+            size_t at = std::find(kids.begin() + parent.child_off, kids.begin() + end, path[i]) - kids.begin();
+            std::copy(kids.begin() + at + 1, kids.begin() + end, kids.begin() + at);
+            std::copy(root->child_chars.begin() + at + 1, root->child_chars.begin() + end, root->child_chars.begin() + at);
+            parent.child_count--;
         }
-        return curr->isLeaf;
     }
 
-    bool isPrefix(TrieNode* root, const std::string &key) {
-        TrieNode* curr = root;
-        for(const char &c: key) {
-            if(curr->children.find(c) == curr->children.end()) return false;
-            curr = curr->children[c];
+    // Build the node for names[lo, hi), which all share names[lo][0, depth).
+    static void buildRange(TrieNode* t, uint32_t idx, const std::vector<std::string> &names, size_t lo, size_t hi, size_t depth) {
+        // Sorted input: the range's common prefix is the LCP of its first and last names.
+        const std::string &first = names[lo], &last = names[hi - 1];
+        size_t lcp = depth;
+        while(lcp < first.size() && lcp < last.size() && first[lcp] == last[lcp]) lcp++;
+
+        Node &n = t->nodes[idx];
+        n.label_off = t->labels.size();
+        n.label_len = lcp - depth;
+        t->labels.append(first, depth, lcp - depth);
+        while(lo < hi && names[lo].size() == lcp) {
+            t->nodes[idx].isLeaf = true;
+            lo++;
+        }
+        if(lo == hi) return;
+
+        std::vector<std::pair<size_t,size_t>> groups;
+        for(size_t i = lo; i < hi; ) {
+            size_t j = i + 1;
+            while(j < hi && names[j][lcp] == names[i][lcp]) j++;
+            groups.emplace_back(i, j);
+            i = j;
+        }
+        uint32_t off = t->children.size();
+        t->nodes[idx].child_off = off;
+        t->nodes[idx].child_count = groups.size();
+        for(auto &[a, b]: groups) {
+            t->nodes.emplace_back();
+            t->children.push_back(t->nodes.size() - 1);
+            t->child_chars.push_back(names[a][lcp]);
+        }
+        for(size_t g = 0; g < groups.size(); ++g) {
+            buildRange(t, t->children[off + g], names, groups[g].first, groups[g].second, lcp);
         }
-        return true;
     }
 
-    void findAllWords(TrieNode* node, std::string currendWord, std::vector<std::string> &words) {
-        if(node->isLeaf){
-            words.push_back(currendWord);
+    void build(TrieNode* root, const std::vector<std::string> &names) {
+        *root = TrieNode();
+        size_t lo = 0;
+        // The root keeps an empty label, so the empty name just marks it a leaf.
+        while(lo < names.size() && names[lo].empty()) {
+            root->nodes[0].isLeaf = true;
+            lo++;
         }
-        for(auto &[c,nextNode]: node->children) {
-            findAllWords(nextNode, currendWord + c, words);
+        if(lo == names.size()) return;
+        std::vector<std::pair<size_t,size_t>> groups;
+        for(size_t i = lo; i < names.size(); ) {
+            size_t j = i + 1;
+            while(j < names.size() && names[j][0] == names[i][0]) j++;
+            groups.emplace_back(i, j);
+            i = j;
+        }
+        root->nodes[0].child_off = 0;
+        root->nodes[0].child_count = groups.size();
+        for(auto &[a, b]: groups) {
+            root->nodes.emplace_back();
+            root->children.push_back(root->nodes.size() - 1);
+            root->child_chars.push_back(names[a][0]);
+        }
+        for(size_t g = 0; g < groups.size(); ++g) {
+            buildRange(root, root->children[g], names, groups[g].first, groups[g].second, 0);
         }
     }
 
-    std::string longestCommonPrefix(TrieNode* node) {
-        std::string prefix = "";
-        while(node->children.size() == 1 && !node->isLeaf){
-            auto [ch, next] = *(node->children.begin());
-            prefix += ch;
-            node = next;
+    // Walk `key`. Returns the node reached and, via `rest`, the part of that
+    // node's label beyond the end of the key. Returns -1 if key isn't a prefix.
+    static long walk(const TrieNode* root, const std::string &key, std::string_view &rest) {
+        uint32_t idx = 0;
+        size_t pos = 0;
+        rest = {};
+        while(pos < key.size()) {
+            long slot = findChild(root, root->node(idx), key[pos]);
+            if(slot == -1) return -1;
+            idx = root->child(slot);
+            std::string_view lbl = label(root, root->node(idx));
+            size_t n = std::min(lbl.size(), key.size() - pos);
+            if(lbl.compare(0, n, key, pos, n) != 0) return -1;
+            pos += n;
+            rest = lbl.substr(n);
         }
-        return prefix;
+        return idx;
+    }
+
+    bool search(TrieNode* root, const std::string &key) {
+        std::string_view rest;
+        long idx = walk(root, key, rest);
+        return idx != -1 && rest.empty() && root->node(idx).isLeaf;
+    }
+
+    bool isPrefix(TrieNode* root, const std::string &key) {
+        std::string_view rest;
+        return walk(root, key, rest) != -1;
+    }
+
+    Completion complete(TrieNode* root, const std::string &key) {
+        std::string_view rest;
+        long idx = walk(root, key, rest);
+        if(idx == -1) return {};
+
+        Completion c;
+        c.prefix = rest;
+        c.count = root->wordCount(idx);
+        const Node *n = &root->node(idx);
+        while(n->child_count == 1 && !n->isLeaf) {
+            n = &root->node(root->child(n->child_off));
+            c.prefix.append(label(root, *n));
+        }
+        return c;
+    }
+
+    Completions::Completions(const TrieNode* root, const std::string &key) : root(root), current(key) {
+        std::string_view rest;
+        long idx = walk(root, key, rest);
+        if(idx == -1) return;
+        current.append(rest);
+        stack.push_back({uint32_t(idx), 0, key.size()});
     }
 
-    std::pair<std::string,std::vector<std::string>> autoComplete(TrieNode* root, const std::string &key){
-        TrieNode* curr = root;
-        for(const char &c: key) {
-            if(curr->children.find(c) == curr->children.end()) return {};
-            curr = curr->children[c];
+    // Depth-first over one shared buffer, resuming where the last call stopped.
+    bool Completions::next(std::string &word) {
+        while(!stack.empty()) {
+            Frame &f = stack.back();
+            const Node &n = root->node(f.node);
+            if(!f.emitted) {
+                f.emitted = true;
+                if(n.isLeaf) {
+                    word = current;
+                    return true;
+                }
+            }
+            if(f.next_child < n.child_count) {
+                uint32_t child = root->child(n.child_off + f.next_child++);
+                size_t base = current.size();
+                current.append(label(root, root->node(child)));
+                stack.push_back({child, 0, base});
+            } else {
+                current.resize(f.base);
+                stack.pop_back();
+            }
         }
-        std::vector<std::string> words = {};
-        findAllWords(curr, "", words);
-        return std::make_pair(longestCommonPrefix(curr), words);
+        return false;
     }
-}
\ No newline at end of file
+}
@@ -1,23 +1,98 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <map>
+#include <cstdint>
+#include <string_view>
 namespace Trie {
+    // Path-compressed radix tree kept in flat arrays: every node, child table
+    // and label byte lives in one of three contiguous buffers, so building it
+    // costs a handful of reallocations instead of one heap node per character.
     class TrieNode
     {
     public:
-        bool isLeaf;
-        std::map<char, TrieNode*> children;
+        struct Node {
+            uint32_t label_off = 0;   // into labels
+            uint32_t label_len = 0;
+            uint32_t child_off = 0;   // into children / child_chars
+            uint32_t child_count : 31 = 0;
+            uint32_t isLeaf : 1 = 0;
+        };
+        std::vector<Node> nodes;             // nodes[0] is the root (empty label)
+        std::vector<uint32_t> children;      // child tables, sorted by first byte
+        std::vector<unsigned char> child_chars; // first label byte of each child, for binary search
+        std::string labels;
+        mutable std::vector<uint32_t> counts; // see wordCount(); cleared by anything that edits the trie
+
+        // Read-only arrays living outside the object (e.g. an mmap'd cache).
+        // When set, lookups use these and the vectors above stay empty.
+        struct Mapped {
+            const Node* nodes = nullptr;
+            size_t node_count = 0;
+            const uint32_t* children = nullptr;
+            const unsigned char* child_chars = nullptr;
+            size_t child_count = 0;
+            const char* labels = nullptr;
+            size_t labels_len = 0;
+        };
+
         TrieNode();
-        ~TrieNode();
+        void attach(const Mapped &m);
+        // Copy attached arrays into owned storage so the trie can be modified.
+        void detach();
+        bool isMapped() const { return mapped.nodes != nullptr; }
+        size_t memoryUsage() const;
+
+        const Node& node(uint32_t i) const { return mapped.nodes ? mapped.nodes[i] : nodes[i]; }
+        uint32_t child(size_t i) const { return mapped.nodes ? mapped.children[i] : children[i]; }
+        const unsigned char* childChars() const { return mapped.nodes ? mapped.child_chars : child_chars.data(); }
+        std::string_view labelData() const { return mapped.nodes ? std::string_view(mapped.labels, mapped.labels_len) : std::string_view(labels); }
+        size_t nodeCount() const { return mapped.nodes ? mapped.node_count : nodes.size(); }
+        size_t childCount() const { return mapped.nodes ? mapped.child_count : children.size(); }
+        // Words in the subtree of node i (itself included). Counted for the whole
+        // trie on first use and kept until the next insert/build/attach.
+        uint32_t wordCount(uint32_t i) const;
+
+    private:
+        Mapped mapped;
+        uint32_t countWords(uint32_t i) const;
     };
     
     void insert(TrieNode* root, const std::string &key);
 
+    // Drop `key`, unlinking the nodes only it kept alive. No-op if absent.
+    void remove(TrieNode* root, const std::string &key);
+
+    // Replace the contents with `names` (must be sorted; duplicates allowed).
+    // Child tables come out contiguous, with no relocation garbage.
+    void build(TrieNode* root, const std::vector<std::string> &names);
+
     bool search(TrieNode* root, const std::string &key);
 
     bool isPrefix(TrieNode* root, const std::string &key);
 
-    std::pair<std::string,std::vector<std::string>> autoComplete(TrieNode* root, const std::string &key);
-}
+    // What `key` completes to, without visiting the words: the continuation
+    // they all share and how many there are (0 if key isn't a prefix).
+    struct Completion {
+        std::string prefix;
+        size_t count = 0;
+    };
+    Completion complete(TrieNode* root, const std::string &key);
 
+    // The words starting with `key`, in sorted order, one per next() call.
+    // Only as much of the subtree is walked as has been asked for.
+    class Completions {
+    public:
+        Completions(const TrieNode* root, const std::string &key);
+        bool next(std::string &word);
+    private:
+        struct Frame {
+            uint32_t node;
+            uint32_t next_child = 0;
+            size_t base;            // length of `current` before this node's label
+            bool emitted = false;
+        };
+        const TrieNode* root;
+        std::string current;
+        std::vector<Frame> stack;
+    };
+}